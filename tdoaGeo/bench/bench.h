@@ -0,0 +1,39 @@
+#pragma once
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <valarray>
+
+//Benchmarks of the signal and solver paths, each against the code it replaced where that is still worth
+//comparing with. Each prints what it measured and returns false if a check failed.
+bool benchFft();
+bool benchRefine();
+bool benchQueue();
+bool benchSimplex();
+
+//Accumulates the time between start() and stop() over many calls
+class stopwatch
+{
+public:
+	void start() { _start = std::chrono::steady_clock::now(); };
+	void stop() { _total += std::chrono::steady_clock::now() - _start; _calls++; };
+	double perCall_us() const { return _calls > 0 ? std::chrono::duration<double, std::micro>(_total).count() / _calls : 0; };
+private:
+	std::chrono::steady_clock::time_point _start;
+	std::chrono::steady_clock::duration _total = std::chrono::steady_clock::duration::zero();
+	size_t _calls = { 0 };
+};
+
+//Zero pad a spectrum as node::UpSampleSpectrum does
+template <class S> inline S upsample(const S &spectrum, size_t interpolation)
+{
+	const size_t N = spectrum.size(), M = interpolation * N, shift = N / 2;
+	S padded(M);
+	std::copy(std::begin(spectrum), std::begin(spectrum) + (N - shift), std::begin(padded));
+	std::copy(std::begin(spectrum) + (N - shift), std::end(spectrum), std::begin(padded) + (M - shift));
+	padded[shift] /= 2;
+	padded[M - shift] = padded[shift];
+	padded *= static_cast<typename S::value_type::value_type>(interpolation);
+	return padded;
+}
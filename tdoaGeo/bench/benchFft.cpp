@@ -0,0 +1,179 @@
+#include <random>
+#include <numeric>
+#include "fft.h"
+#include "bench.h"
+
+//The transform and correlation as they were before the radix-4/mixed-radix FFT and the fused correlation
+//kernel: recursive Cooley-Tukey on powers of two, then multiply, invert, cshift, abs and a search for the
+//peak as separate passes. Always double, so it is also the reference for a SINGLE_PRECISION build.
+typedef std::complex<double> legacyComplex;
+typedef std::valarray<legacyComplex> legacySignal;
+
+static void legacyTransform(legacySignal &x, const std::vector<legacyComplex> &twiddle)
+{
+	const size_t N = x.size();
+	if (N <= 1)
+		return;
+	legacySignal even = x[std::slice(0, N / 2, 2)];
+	legacySignal odd = x[std::slice(1, N / 2, 2)];
+	legacyTransform(even, twiddle);
+	legacyTransform(odd, twiddle);
+	size_t step = 2 * twiddle.size() / N;
+	for (size_t i = 0, k = 0; k < N / 2; ++k, i += step)
+	{
+		legacyComplex t = twiddle[i] * odd[k];
+		x[k] = even[k] + t;
+		x[k + N / 2] = even[k] - t;
+	}
+}
+
+static std::vector<legacyComplex> legacyTwiddle(size_t N)
+{
+	std::vector<legacyComplex> twiddle(N / 2);
+	for (size_t k = 0; k < N / 2; ++k)
+		twiddle[k] = std::polar<double>(1.0, -2 * M_PI * k / N);
+	return twiddle;
+}
+
+//Lag of the peak in samples as the old tdoa::correlate found it, with the master conjugated beforehand
+static int32_t legacyCorrelate(const legacySignal &master, legacySignal &slave, const std::vector<legacyComplex> &twiddle)
+{
+	slave *= master.apply(std::conj);
+	slave = slave.apply(std::conj);
+	legacyTransform(slave, twiddle);
+	slave = slave.apply(std::conj);
+	slave /= static_cast<double>(slave.size());
+	slave = slave.cshift(static_cast<int>(slave.size() / 2));
+	std::vector<double> correlation(slave.size());
+	for (size_t i = 0; i < correlation.size(); i++)
+		correlation[i] = std::abs(slave[i]);
+	auto max = std::max_element(correlation.begin(), correlation.end());
+	return static_cast<int32_t>(std::distance(correlation.begin(), max)) - static_cast<int32_t>(correlation.size() / 2);
+}
+
+static TSignal toSignal(const legacySignal &x)
+{
+	TSignal s(x.size());
+	for (size_t i = 0; i < x.size(); i++)
+		s[i] = TComplex(static_cast<TSample>(x[i].real()), static_cast<TSample>(x[i].imag()));
+	return s;
+}
+
+//Largest error of the transform of x against the reference, relative to the largest reference value
+static double transformError(const legacySignal &x, const legacySignal &reference)
+{
+	TSignal s = toSignal(x);
+	fft f;
+	f.transform(s);
+	double error = 0, largest = 0;
+	for (size_t k = 0; k < x.size(); k++)
+	{
+		error = std::max(error, std::abs(legacyComplex(s[k].real(), s[k].imag()) - reference[k]));
+		largest = std::max(largest, std::abs(reference[k]));
+	}
+	return error / largest;
+}
+
+bool benchFft()
+{
+	bool ok = true;
+	const double tolerance = sizeof(TSample) == sizeof(double) ? 1e-9 : 1e-5;
+	std::cout << "precision: " << (sizeof(TSample) == sizeof(double) ? "double" : "single (SINGLE_PRECISION)") << std::endl;
+	std::mt19937 rng(1);
+	std::normal_distribution<double> normal(0, 1);
+
+	//Accuracy against the old transform on powers of two, and a direct DFT on sizes it couldn't do
+	for (size_t N : { 64, 1024, 32768 })
+	{
+		legacySignal x(N);
+		for (auto &v : x)
+			v = legacyComplex(normal(rng), normal(rng));
+		legacySignal reference = x;
+		legacyTransform(reference, legacyTwiddle(N));
+		double error = transformError(x, reference);
+		std::cout << "transform " << N << ": error " << error << " against the old transform" << std::endl;
+		ok &= error < tolerance;
+	}
+	for (size_t N : { 360, 1080, 1100 })
+	{
+		legacySignal x(N), reference(N);
+		for (auto &v : x)
+			v = legacyComplex(normal(rng), normal(rng));
+		for (size_t k = 0; k < N; k++)
+			for (size_t n = 0; n < N; n++)
+				reference[k] += x[n] * std::polar(1.0, -2 * M_PI * static_cast<double>((k * n) % N) / N);
+		double error = transformError(x, reference);
+		std::cout << "transform " << N << ": error " << error << " against a direct DFT" << std::endl;
+		ok &= error < tolerance;
+	}
+
+	//Speed of the transform at the upsampled size, and at a mixed radix one the old code would have truncated
+	for (size_t N : { 32768, 34560 })
+	{
+		TSignal s(N);
+		for (auto &v : s)
+			v = TComplex(static_cast<TSample>(normal(rng)), static_cast<TSample>(normal(rng)));
+		fft f;
+		stopwatch now;
+		for (int i = 0; i < 50; i++)
+		{
+			now.start();
+			f.transform(s);
+			now.stop();
+		}
+		std::cout << "transform " << N << ": " << now.perCall_us() << " us";
+		if ((N & (N - 1)) == 0)
+		{
+			legacySignal x(N);
+			std::vector<legacyComplex> twiddle = legacyTwiddle(N);
+			stopwatch old;
+			for (int i = 0; i < 10; i++)
+			{
+				old.start();
+				legacyTransform(x, twiddle);
+				old.stop();
+			}
+			std::cout << ", old " << old.perCall_us() << " us";
+		}
+		std::cout << std::endl;
+	}
+
+	//Captures of 1024 samples at 2 MHz, delayed within +-20 us and upsampled 32 times as the nodes do, so
+	//one sample is 15.6 ns. The offsets must be exactly those of the old path.
+	const size_t capture = 1024, interpolation = 32, trials = 100;
+	const double rate = 2e6, sampleTime = 1e9 / (rate * interpolation);
+	std::uniform_real_distribution<double> delay(-20e-6, 20e-6);
+	std::vector<legacyComplex> twiddle = legacyTwiddle(capture * interpolation);
+	fft f;
+	stopwatch now, old;
+	size_t differ = 0;
+	double error = 0;
+	for (size_t t = 0; t < trials; t++)
+	{
+		legacySignal master(capture), slave(capture);
+		for (auto &v : master)
+			v = legacyComplex(2000 * normal(rng), 2000 * normal(rng));
+		legacyTransform(master, legacyTwiddle(capture));
+		double tau = delay(rng);
+		for (size_t k = 0; k < capture; k++)
+		{
+			double frequency = (k < capture / 2 ? static_cast<double>(k) : static_cast<double>(k) - capture) * rate / capture;
+			slave[k] = master[k] * std::polar(1.0, -2 * M_PI * frequency * tau);
+		}
+		legacySignal m = upsample(master, interpolation), s = upsample(slave, interpolation);
+		TSignal ms = toSignal(m), ss = toSignal(s);
+		correlationPeak peak;
+		now.start();
+		f.correlate(ms, ss, peak);
+		now.stop();
+		old.start();
+		int32_t offset = legacyCorrelate(m, s, twiddle);
+		old.stop();
+		differ += peak.offset != offset;
+		error += pow(peak.offset * sampleTime - tau * 1e9, 2);
+	}
+	std::cout << "correlate " << capture * interpolation << ": " << now.perCall_us() << " us, old " << old.perCall_us() << " us, "
+			  << differ << "/" << trials << " offsets differ from the old path, rms error " << sqrt(error / trials) << " ns" << std::endl;
+	ok &= differ == 0;
+	return ok;
+}
@@ -0,0 +1,126 @@
+#include <thread>
+#include <vector>
+#include "safeQueue.h"
+#include "ringQueue.h"
+#include "bench.h"
+
+//Throughput of the capture path queue, the ring against the SafeQueue it replaced, with as many producers as
+//there might be node threads. Each item carries its producer and a count, so the consumer can check that
+//every producer's items come out in the order they went in.
+static const uintptr_t items = 1 << 20;
+
+static uintptr_t item(uintptr_t producer, uintptr_t i)
+{
+	return producer << 24 | i;
+}
+
+//Producers that each push their share of the items
+template <class Q> static void produce(Q &q, size_t producers, std::vector<std::thread> &threads)
+{
+	const uintptr_t share = items / producers;
+	for (size_t p = 0; p < producers; p++)
+		threads.emplace_back([&q, p, share]
+		{
+			for (uintptr_t i = 0; i < share; i++)
+				q.push(item(p, i));
+		});
+}
+
+//Checks that v follows the previous item from the same producer
+static bool inOrder(uintptr_t v, std::vector<intptr_t> &last)
+{
+	size_t producer = v >> 24;
+	intptr_t i = v & 0xffffff;
+	bool ok = i == last[producer] + 1;
+	last[producer] = i;
+	return ok;
+}
+
+//Items per second through front() and pop(), the way tdoa::run used to read SafeQueue
+template <class Q> static double frontPop(Q &q, size_t producers, bool &ok)
+{
+	std::vector<std::thread> threads;
+	std::vector<intptr_t> last(producers, -1);
+	const uintptr_t total = items / producers * producers;
+	auto start = std::chrono::steady_clock::now();
+	produce(q, producers, threads);
+	for (uintptr_t k = 0; k < total; k++)
+	{
+		ok &= inOrder(q.front(), last);
+		q.pop();
+	}
+	for (auto &t : threads)
+		t.join();
+	return total / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Items per second taken 16 at a time, as tdoa::run reads the ring now
+static double batch(MpscQueue<uintptr_t> &q, size_t producers, bool &ok)
+{
+	std::vector<std::thread> threads;
+	std::vector<intptr_t> last(producers, -1);
+	const uintptr_t total = items / producers * producers;
+	uintptr_t taken[16];
+	auto start = std::chrono::steady_clock::now();
+	produce(q, producers, threads);
+	for (uintptr_t k = 0; k < total; )
+	{
+		size_t n = q.popBatch(taken, 16);
+		for (size_t j = 0; j < n; j++)
+			ok &= inOrder(taken[j], last);
+		k += n;
+	}
+	for (auto &t : threads)
+		t.join();
+	return total / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool benchQueue()
+{
+	bool ok = true;
+	std::cout << "hardware threads: " << std::thread::hardware_concurrency() << ", " << items << " items, ring capacity 1024, best of 3" << std::endl;
+	for (size_t producers : { 1, 4, 16, 64 })
+	{
+		double safe = 0, ring = 0, batched = 0;
+		MpscQueue<uintptr_t>::statistics stats = { 0, 0 };
+		for (int r = 0; r < 3; r++)
+		{
+			SafeQueue<uintptr_t> s;
+			MpscQueue<uintptr_t> q(1024), b(1024);
+			safe = std::max(safe, frontPop(s, producers, ok));
+			ring = std::max(ring, frontPop(q, producers, ok));
+			batched = std::max(batched, batch(b, producers, ok));
+			stats = b.stats();
+		}
+		std::cout << producers << " producers: SafeQueue " << safe / 1e6 << " M/s, ring front/pop " << ring / 1e6 << " M/s, ring popBatch "
+				  << batched / 1e6 << " M/s (full " << stats.full << ", empty " << stats.empty << ")" << std::endl;
+	}
+
+	//Push and pop in one thread, the cost of the queue itself with nothing to contend with
+	SafeQueue<uintptr_t> s;
+	MpscQueue<uintptr_t> q(1024);
+	stopwatch safe, ring;
+	for (int r = 0; r < 100; r++)
+	{
+		safe.start();
+		for (uintptr_t i = 0; i < 1000; i++)
+		{
+			s.push(i);
+			ok &= s.front() == i;
+			s.pop();
+		}
+		safe.stop();
+		ring.start();
+		for (uintptr_t i = 0; i < 1000; i++)
+		{
+			q.push(i);
+			ok &= q.front() == i;
+			q.pop();
+		}
+		ring.stop();
+	}
+	std::cout << "one thread: SafeQueue " << safe.perCall_us() << " ns, ring " << ring.perCall_us() << " ns per item" << std::endl;
+	if (!ok)
+		std::cout << "items out of order" << std::endl;
+	return ok;
+}
@@ -0,0 +1,102 @@
+#include <random>
+#include <numeric>
+#include "fft.h"
+#include "bench.h"
+
+//Accuracy and cost of the ways fft::correlate can find the delay below one sample. Upsampling 32 times
+//in the node and taking whole samples is what the nodes did before; parabolic and zoom refine the peak
+//of a correlation at the capture rate instead. Captures are made as node::getPacketData(void) makes them,
+//a band limited signal delayed in the master's copy with independent noise on each.
+bool benchRefine()
+{
+	bool ok = true;
+	const size_t capture = 1080, interpolation = 32, trials = 400;
+	const double rate = 1.5e6, sampleTime = 1e9 / rate;
+	std::mt19937 rng(7);
+	std::normal_distribution<double> normal(0, 1);
+	std::uniform_real_distribution<double> delay(-100e-6, 100e-6);
+	fft f;
+	for (double snr_dB : { 40.0, 10.0, 0.0 })
+	{
+		const double noise = pow(10, -snr_dB / 20);
+		std::vector<TSignal> masters, slaves;
+		std::vector<double> truth;
+		for (size_t t = 0; t < trials; t++)
+		{
+			TSignal base(capture);
+			for (auto &v : base)
+				v = TComplex(static_cast<TSample>(normal(rng)), static_cast<TSample>(normal(rng)));
+			f.transform(base);
+			double tau = delay(rng);
+			TSignal master = base, slave = base;
+			for (size_t k = 0; k < capture; k++)
+			{
+				double frequency = (k < capture / 2 ? static_cast<double>(k) : static_cast<double>(k) - capture) / capture;
+				if (fabs(frequency) > 0.4)
+					master[k] = slave[k] = 0;
+				else
+					slave[k] *= TComplex(std::polar(1.0, -2 * M_PI * frequency * rate * tau));
+			}
+			f.invert(master);
+			f.invert(slave);
+			for (size_t i = 0; i < capture; i++)
+			{
+				master[i] += TComplex(static_cast<TSample>(noise * normal(rng)), static_cast<TSample>(noise * normal(rng)));
+				slave[i] += TComplex(static_cast<TSample>(noise * normal(rng)), static_cast<TSample>(noise * normal(rng)));
+			}
+			f.transform(master);
+			f.transform(slave);
+			masters.push_back(master);
+			slaves.push_back(slave);
+			truth.push_back(tau * 1e9);
+		}
+
+		struct method
+		{
+			const char *name;
+			bool upsampled;
+			peakRefinement refine;
+		};
+		const method methods[] = { { "upsample x32", true, REFINE_NONE }, { "parabolic", false, REFINE_PARABOLIC },
+								   { "zoom", false, REFINE_ZOOM }, { "upsample x32 + zoom", true, REFINE_ZOOM } };
+		double upsampledError = 0;
+		for (auto &m : methods)
+		{
+			stopwatch upsampling, correlating;
+			double error = 0, worst = 0;
+			for (size_t t = 0; t < trials; t++)
+			{
+				TSignal master, slave;
+				upsampling.start();
+				if (m.upsampled)
+				{
+					master = upsample(masters[t], interpolation);
+					slave = upsample(slaves[t], interpolation);
+				}
+				else
+				{
+					master = masters[t];
+					slave = slaves[t];
+				}
+				upsampling.stop();
+				correlationPeak peak;
+				correlating.start();
+				f.correlate(master, slave, peak, m.refine);
+				correlating.stop();
+				double e = peak.delay * sampleTime / (m.upsampled ? interpolation : 1) - truth[t];
+				error += e * e;
+				worst = std::max(worst, fabs(e));
+			}
+			error = sqrt(error / trials);
+			if (m.refine == REFINE_NONE)
+				upsampledError = error;
+			std::cout << "snr " << snr_dB << " dB, " << m.name << ": rms " << error << " ns, max " << worst << " ns, upsample "
+					  << upsampling.perCall_us() << " us, correlate " << correlating.perCall_us() << " us" << std::endl;
+			//Zoom stands in for the upsampling, so it has to be at least as good. Near 0 dB the whole
+			//sample peak at the capture rate can land on the wrong sample, so there it is only reported.
+			if (m.refine == REFINE_ZOOM && snr_dB >= 10)
+				ok &= error <= 1.1 * upsampledError;
+		}
+	}
+	return ok;
+}
@@ -0,0 +1,113 @@
+#include <new>
+#include <cstdlib>
+#include <atomic>
+#include <deque>
+#include "tdoaCost.h"
+#include "legacySimplex.h"
+#include "bench.h"
+
+//The templated simplex against the std::function one it replaced, on the same cost function the solver
+//uses and from the same seed, so every search must come out bit for bit the same. Allocations are counted
+//by replacing the global operator new for the whole bench, which costs the other benchmarks one relaxed
+//increment each.
+static std::atomic<size_t> allocations = { 0 };
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+//One search by each, seeded alike. The old one is timed from construction as tdoa made one per search; the
+//template sizes its batch buffer when it is made and is reused, so only its search is timed. Returns true if they found the same point with the same error.
+template <size_t N> static bool compare(const tdoaCost &cost, const std::valarray<double> &start, uint32_t seed, stopwatch &old, stopwatch &now,
+										size_t &oldAllocations, size_t &newAllocations)
+{
+	std::valarray<double> a = start;
+	size_t before = allocations;
+	old.start();
+	legacySimplex legacy([&cost](std::valarray<double> d) { return cost.evaluate(d); }, [&cost](const pointBatch &p, double *r) { cost.evaluate(p, r); });
+	legacy.seed(seed);
+	double oldRms = legacy.optimise(a, 1000, 1e-6);
+	old.stop();
+	oldAllocations += allocations - before;
+
+	auto splx = makeSimplex<N>([&cost](const std::array<double, N> &d) { return cost.evaluate(d.data(), N); },
+							   [&cost](const pointBatch &p, double *r) { cost.evaluate(p, r); });
+	splx.reset(seed);
+	std::array<double, N> b;
+	std::copy(std::begin(start), std::end(start), b.begin());
+	before = allocations;
+	now.start();
+	double newRms = splx.optimise(b, 1000, 1e-6);
+	now.stop();
+	newAllocations += allocations - before;
+
+	bool same = oldRms == newRms;
+	for (size_t d = 0; d < N; d++)
+		same &= a[d] == b[d];
+	return same;
+}
+
+bool benchSimplex()
+{
+	bool ok = true;
+	//The node layout of tdoa.cfg, emitters scattered over and around it
+	const double nodes[4][3] = { { 52, 0, 200 }, { 52.1, 0, 600 }, { 52.05, 0.05, 0 }, { 52.0, 0.1, 300 } };
+	const size_t runs = 300;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> spread(-0.04, 0.08), height(0, 3000);
+	for (bool threeDimensions : { false, true })
+	{
+		const size_t count = threeDimensions ? 4 : 3;
+		stopwatch old, now;
+		size_t same = 0, oldAllocations = 0, newAllocations = 0;
+		for (size_t r = 0; r < runs; r++)
+		{
+			location emitter(52.0 + spread(rng) * 0.8, spread(rng), threeDimensions ? height(rng) : 0);
+			std::vector<point3> positions;
+			std::vector<int32_t> delays;
+			std::deque<location> nodeLocations;
+			point3 middle = { 0, 0, 0 };
+			for (size_t i = 0; i < count; i++)
+			{
+				nodeLocations.push_back(location(nodes[i][LAT], nodes[i][LON], threeDimensions ? nodes[i][ALT] : 0));
+				positions.push_back(nodeLocations.back().getCartesian());
+				delays.push_back(static_cast<int32_t>(lround((nodeLocations[i].distance(emitter) - nodeLocations[0].distance(emitter)) * 1e9 / SPEED_OF_LIGHT)));
+				middle.x += positions.back().x;
+				middle.y += positions.back().y;
+				middle.z += positions.back().z;
+			}
+			location anchor;
+			anchor.setCartesian(middle);
+			enuFrame frame;
+			frame.setOrigin(anchor);
+			tdoaCost cost;
+			cost.setNodes(positions, delays, frame, threeDimensions, -1e9);
+			//Start at the master as the solver does without an estimate
+			point3 master = frame.toLocal(positions.front());
+			std::valarray<double> start = { master.x, master.y, master.z };
+			if (threeDimensions)
+				same += compare<3>(cost, start, static_cast<uint32_t>(r + 1), old, now, oldAllocations, newAllocations);
+			else
+				same += compare<2>(cost, start[std::slice(0, 2, 1)], static_cast<uint32_t>(r + 1), old, now, oldAllocations, newAllocations);
+		}
+		std::cout << (threeDimensions ? "3D" : "2D") << ": old " << old.perCall_us() << " us and " << oldAllocations / runs << " allocations, template "
+				  << now.perCall_us() << " us and " << newAllocations / runs << " allocations per search, " << same << "/" << runs << " identical" << std::endl;
+		ok &= same == runs && newAllocations == 0;
+	}
+	return ok;
+}
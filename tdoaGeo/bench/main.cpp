@@ -0,0 +1,30 @@
+#include <iostream>
+#include <string>
+#include "bench.h"
+
+//Runs the benchmarks named on the command line, or all of them. Exits with 1 if any check failed.
+int main(int argc, char *argv[])
+{
+	struct entry
+	{
+		const char *name;
+		bool (*run)();
+	};
+	const entry benches[] = { { "fft", benchFft }, { "refine", benchRefine }, { "queue", benchQueue }, { "simplex", benchSimplex } };
+	bool ok = true;
+	for (auto &b : benches)
+	{
+		bool wanted = argc < 2;
+		for (int a = 1; a < argc; a++)
+			wanted |= b.name == std::string(argv[a]);
+		if (!wanted)
+			continue;
+		std::cout << "== " << b.name << std::endl;
+		if (!b.run())
+		{
+			std::cout << b.name << " FAILED" << std::endl;
+			ok = false;
+		}
+	}
+	return ok ? 0 : 1;
+}
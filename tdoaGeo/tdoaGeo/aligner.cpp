@@ -0,0 +1,184 @@
+#include "aligner.h"
+#include <algorithm>
+#include <cstdlib>
+
+aligner::aligner()
+{
+	_ring.resize(1024);
+}
+
+aligner::~aligner()
+{
+	for (auto &p : _order)
+	{
+		if (p.open)
+		{
+			for (auto c : *p.captures)
+				c->release();
+			delete p.captures;
+		}
+	}
+	for (auto v : _spare)
+		delete v;
+}
+
+void aligner::configure(size_t nodes, int64_t tolerance_ns, int32_t wait_ms, size_t minCaptures)
+{
+	_nodes = nodes;
+	_tolerance_ns = std::max<int64_t>(1, tolerance_ns);
+	_wait = std::chrono::milliseconds(wait_ms);
+	_minCaptures = minCaptures;
+}
+
+void aligner::add(capture *packet, std::vector<alignedSet> &ready)
+{
+	int64_t bucket = packet->_time / _tolerance_ns;
+	//Look for an open set close enough in time in this bucket or either neighbour
+	pending *match = NULL;
+	for (int64_t b = bucket - 1; b <= bucket + 1 && match == NULL; b++)
+	{
+		for (auto p : at(b).open)
+		{
+			if (p->bucket == b && std::abs(packet->_time - p->time) <= _tolerance_ns)
+			{
+				match = p;
+				break;
+			}
+		}
+	}
+	if (match == NULL)
+	{
+		//Too late for a set that has already been handed on or given up on
+		for (int64_t b = bucket - 1; b <= bucket + 1; b++)
+		{
+			int64_t closed = at(b).closed;
+			if (closed != std::numeric_limits<int64_t>::min() && std::abs(packet->_time - closed) <= _tolerance_ns)
+			{
+				_late++;
+				packet->release();
+				return;
+			}
+		}
+		pending p;
+		p.time = packet->_time;
+		p.bucket = bucket;
+		p.deadline = std::chrono::steady_clock::now() + _wait;
+		p.captures = spare();
+		p.open = true;
+		_order.push_back(p);
+		match = &_order.back();
+		at(bucket).open.push_back(match);
+	}
+	else
+	{
+		for (auto c : *match->captures)
+		{
+			if (c->_host == packet->_host && c->_port == packet->_port)
+			{
+				_duplicate++;
+				packet->release();
+				return;
+			}
+		}
+	}
+	match->captures->push_back(packet);
+	if (_nodes > 0 && match->captures->size() >= _nodes)
+		close(*match, false, ready);
+}
+
+void aligner::close(pending &p, bool timedOut, std::vector<alignedSet> &ready)
+{
+	slot &s = at(p.bucket);
+	for (size_t i = 0; i < s.open.size(); i++)
+	{
+		if (s.open[i] == &p)
+		{
+			s.open[i] = s.open.back();
+			s.open.pop_back();
+			break;
+		}
+	}
+	s.closed = std::max(s.closed, p.time);
+	p.open = false;
+	if (p.captures->size() >= _minCaptures)
+	{
+		if (timedOut)
+			_partial++;
+		else
+			_complete++;
+		alignedSet set;
+		set._time = p.time;
+		set._captures = p.captures;
+		ready.push_back(set);
+	}
+	else
+	{
+		_orphaned += p.captures->size();
+		for (auto c : *p.captures)
+			c->release();
+		recycle(p.captures);
+	}
+	p.captures = NULL;
+	//Closed sets are only kept in the queue while something older is still open
+	while (!_order.empty() && !_order.front().open)
+		_order.pop_front();
+}
+
+std::vector<capture *> *aligner::spare()
+{
+	if (_spare.empty())
+		return new std::vector<capture *>;
+	std::vector<capture *> *v = _spare.back();
+	_spare.pop_back();
+	return v;
+}
+
+void aligner::recycle(std::vector<capture *> *captures)
+{
+	captures->clear();
+	_spare.push_back(captures);
+}
+
+void aligner::expire(std::chrono::steady_clock::time_point now, std::vector<alignedSet> &ready)
+{
+	while (!_order.empty() && _order.front().deadline <= now)
+	{
+		if (_order.front().open)
+			close(_order.front(), true, ready);
+		else
+			_order.pop_front();
+	}
+}
+
+void aligner::flush(std::vector<alignedSet> &ready)
+{
+	while (!_order.empty())
+	{
+		if (_order.front().open)
+			close(_order.front(), true, ready);
+		else
+			_order.pop_front();
+	}
+}
+
+int64_t aligner::oldest() const
+{
+	int64_t time = std::numeric_limits<int64_t>::max();
+	for (auto &p : _order)
+	{
+		if (p.open)
+			time = std::min(time, p.time);
+	}
+	return time;
+}
+
+std::chrono::milliseconds aligner::timeToDeadline(std::chrono::steady_clock::time_point now) const
+{
+	if (_order.empty())
+		return _wait;
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(_order.front().deadline - now);
+	if (left.count() < 0)
+		return std::chrono::milliseconds(0);
+	//Round up so we don't wake just short of it
+	return left + std::chrono::milliseconds(1);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <limits>
+#include "node.h"
+
+//A set of captures of the same transmission, at most one from each node
+struct alignedSet
+{
+	int64_t _time;					//ns, time of the first capture in the set
+	std::vector<capture *> *_captures;
+};
+
+//Groups captures from the nodes into sets of the same transmission. Captures match if they are within
+//the tolerance of the first in a set, wherever that falls relative to a clock boundary. Open sets sit in
+//a ring of time buckets one tolerance wide, so a capture only has to look in its own bucket and the two
+//either side. Each set has a wall clock deadline from when it was opened. A set is handed on as soon as
+//every node has reported or, once the deadline passes, with whatever it has if that is enough to solve.
+class aligner
+{
+public:
+	aligner();
+	~aligner();
+	void configure(size_t nodes, int64_t tolerance_ns, int32_t wait_ms, size_t minCaptures = 3);
+	//Adds the capture, taking ownership. Any set it completes is appended to ready.
+	void add(capture *packet, std::vector<alignedSet> &ready);
+	//Closes the sets whose deadline has passed
+	void expire(std::chrono::steady_clock::time_point now, std::vector<alignedSet> &ready);
+	//Time of the oldest set still open, so results can be held back until it is handed on
+	int64_t oldest() const;
+	//How long until the next deadline, or wait_ms if nothing is open
+	std::chrono::milliseconds timeToDeadline(std::chrono::steady_clock::time_point now) const;
+	//Hands on everything still open regardless of deadline, e.g. at shutdown
+	void flush(std::vector<alignedSet> &ready);
+	//Gives back the vector of a set that has been handed on, once its captures have been taken out of it, so
+	//the next set can reuse it
+	void recycle(std::vector<capture *> *captures);
+
+	uint64_t _complete = { 0 };		//sets handed on with every node
+	uint64_t _partial = { 0 };		//sets handed on at their deadline with some nodes missing
+	uint64_t _orphaned = { 0 };		//captures dropped as too few others arrived in time
+	uint64_t _late = { 0 };			//captures dropped as their set had already gone
+	uint64_t _duplicate = { 0 };	//captures dropped as their node was already in the set
+
+private:
+	struct pending
+	{
+		int64_t time;
+		int64_t bucket;
+		std::chrono::steady_clock::time_point deadline;
+		std::vector<capture *> *captures;
+		bool open;
+	};
+	struct slot
+	{
+		std::vector<pending *> open;		//rarely more than one
+		int64_t closed = { std::numeric_limits<int64_t>::min() };	//time of the last set closed here
+	};
+	slot &at(int64_t bucket) { return _ring[static_cast<size_t>(bucket) & (_ring.size() - 1)]; };
+	void close(pending &p, bool timedOut, std::vector<alignedSet> &ready);
+	std::vector<capture *> *spare();
+
+	std::vector<slot> _ring;
+	std::deque<pending> _order;				//oldest first. Deadlines are in the same order
+	std::vector<std::vector<capture *> *> _spare;	//empty vectors from sets already dealt with
+	size_t _nodes = { 0 };
+	size_t _minCaptures = { 3 };
+	int64_t _tolerance_ns = { 1000 };
+	std::chrono::milliseconds _wait = std::chrono::milliseconds(1000);
+};
@@ -1,13 +1,117 @@
 // fft.cpp : Defines the exported functions for the DLL application.
 //
 #include "fft.h"
+#include "simd.h"
 #include <algorithm>
 
 using namespace std;
 
+std::atomic<const fftPlan *> fftPlan::_head = { NULL };
+std::mutex fftPlan::_mtx;
+std::vector<std::unique_ptr<fftPlan>> fftPlan::_owner;
+
+fftPlan::fftPlan(size_t N)
+{
+	_N = N;
+	_twiddle.resize(N);
+	for (size_t k = 0; k < N; ++k)
+	{
+		_twiddle[k] = TComplex(std::polar<double>(1.0, -2 * M_PI * k / N));
+	}
+	//Factor into passes, smallest first: a radix-2 pass if there is an odd power of two, then
+	//radix-4, 3 and 5 passes and finally any other prime factors
+	std::vector<size_t> radices;
+	size_t n = N;
+	size_t twos = 0;
+	for (; n > 1 && n % 2 == 0; n /= 2)
+		twos++;
+	if (twos & 1)
+		radices.push_back(2);
+	for (size_t i = 0; i < twos / 2; i++)
+		radices.push_back(4);
+	for (size_t f = 3; n > 1; f += 2)
+	{
+		for (; n % f == 0; n /= f)
+			radices.push_back(f);
+	}
+	//Contiguous twiddles for each pass: w^(q*k) for q = 1..radix-1 and k < m where w = exp(-2*pi*i/(m*radix))
+	size_t m = 1;
+	for (size_t r : radices)
+	{
+		stage s = { r, m, _stageTwiddle.size() };
+		_stages.push_back(s);
+		for (size_t q = 1; q < r; q++)
+		{
+			for (size_t k = 0; k < m; k++)
+			{
+				_stageTwiddle.push_back(_twiddle[(q * k * (N / (m * r))) % N]);
+			}
+		}
+		m *= r;
+	}
+	//Digit reversal. Radix-4 passes take their inputs in radix-2 order (the middle pair swapped), so each 4
+	//counts as two binary digits. Position pos of the permuted input holds sample _digitrev[pos].
+	std::vector<size_t> digits;
+	for (size_t r : radices)
+	{
+		if (r == 4)
+		{
+			digits.push_back(2);
+			digits.push_back(2);
+		}
+		else
+			digits.push_back(r);
+	}
+	_digitrev.resize(N);
+	for (size_t pos = 0; pos < N; pos++)
+	{
+		size_t rest = pos;
+		size_t index = 0;
+		for (size_t d : digits)
+		{
+			index = index * d + rest % d;
+			rest /= d;
+		}
+		_digitrev[pos] = static_cast<uint32_t>(index);
+	}
+	//First position of each cycle of the permutation so it can be applied in place
+	std::vector<bool> visited(N, false);
+	for (size_t pos = 0; pos < N; pos++)
+	{
+		if (visited[pos] || _digitrev[pos] == pos)
+			continue;
+		_cycles.push_back(static_cast<uint32_t>(pos));
+		for (size_t i = pos; !visited[i]; i = _digitrev[i])
+			visited[i] = true;
+	}
+}
+
+//Find the plan for a transform size, building it on first use. Lookups walk the published list
+//without taking a lock; only a miss serialises on the mutex.
+const fftPlan *fftPlan::get(size_t N)
+{
+	for (const fftPlan *p = _head.load(std::memory_order_acquire); p != NULL; p = p->_next)
+	{
+		if (p->_N == N)
+			return p;
+	}
+	std::lock_guard<std::mutex> lk(_mtx);
+	//Another thread may have built it while we waited
+	for (const fftPlan *p = _head.load(std::memory_order_acquire); p != NULL; p = p->_next)
+	{
+		if (p->_N == N)
+			return p;
+	}
+	//cout << "computing plan " << N << endl;
+	fftPlan *plan = new fftPlan(N);
+	plan->_next = _head.load(std::memory_order_relaxed);
+	_owner.push_back(std::unique_ptr<fftPlan>(plan));
+	_head.store(plan, std::memory_order_release);
+	return plan;
+}
+
 fft::fft()
 {
-	twiddle.resize(2);
 }
 
 void fft::blackmanHarris(TSignal &x)
@@ -46,10 +150,10 @@ void fft::transform(double real[], double imag[], unsigned int n)
 		{
 			m_N *= 2;
 		}
-		m_valarray = new valarray<complex<double> >(m_N);
+		m_valarray = new TSignal(m_N);
 		for(unsigned int i = 0;i < n;i++)
 		{
-			m_valarray[i] = complex<double>(real[i], imag[i]);
+			m_valarray[i] = TComplex(real[i], imag[i]);
 		}
 		transform(*m_valarray);
 		for(int unsigned i = 0;i < n;i++)
@@ -74,10 +178,10 @@ void fft::invert(double real[], double imag[], unsigned int n)
 		{
 			m_N *= 2;
 		}
-		m_valarray = new valarray<complex<double> >(m_N);
+		m_valarray = new TSignal(m_N);
 		for(unsigned int i = 0;i < n;i++)
 		{
-			m_valarray[i] = complex<double>(real[i], imag[i]);
+			m_valarray[i] = TComplex(real[i], imag[i]);
 		}
 		invert(*m_valarray);
 		for(unsigned int i = 0;i < n;i++)
@@ -106,7 +210,7 @@ void fft::transform(std::vector<double> &real, std::vector<double> &imag)
 		TSignal s(m_N);
 		for (size_t i = 0; i < n; i++)
 		{
-			s[i] = complex<double>(real[i], imag[i]);
+			s[i] = TComplex(real[i], imag[i]);
 		}
 		transform(s);
 		for(size_t i = 0; i < n; i++)
@@ -134,7 +238,7 @@ void fft::invert(std::vector<double> &real, std::vector<double> &imag)
 		TSignal s(m_N);
 		for (size_t i = 0; i < n; i++)
 		{
-			s[i] = complex<double>(real[i], imag[i]);
+			s[i] = TComplex(real[i], imag[i]);
 		}
 		invert(s);
 		for (size_t i = 0; i < n; i++)
@@ -155,44 +259,767 @@ void fft::transform(TSignal &x)
 	coolytukey(x);
 }
 
+//Twiddle multiply, conjugated for the inverse transform
+template <class V, bool inverse> static inline V twiddleMul(const V &x, const V &w)
+{
+	return inverse ? V::mulConj(x, w) : V::mul(x, w);
+}
+
+//Length 3 and 5 DFT constants
+static const TSample SIN60 = static_cast<TSample>(0.86602540378443864676);
+static const TSample COS72 = static_cast<TSample>(0.30901699437494742410);
+static const TSample COS144 = static_cast<TSample>(-0.80901699437494742410);
+static const TSample SIN72 = static_cast<TSample>(0.95105651629515357212);
+static const TSample SIN144 = static_cast<TSample>(0.58778525229247312917);
+
+//Small DFTs of the butterfly inputs in place, natural order in and out
+template <class V, bool inverse, size_t radix> static inline void dft(V *x)
+{
+	switch (radix)
+	{
+	case 2:
+	{
+		V a = x[0];
+		x[0] = a + x[1];
+		x[1] = a - x[1];
+		break;
+	}
+	case 3:
+	{
+		V t1 = x[1] + x[2];
+		V t2 = x[0] - V::scale(t1, 0.5);
+		V t3 = V::template rotate<inverse>(V::scale(x[1] - x[2], SIN60));
+		x[0] = x[0] + t1;
+		x[1] = t2 + t3;
+		x[2] = t2 - t3;
+		break;
+	}
+	case 5:
+	{
+		V t1 = x[1] + x[4];
+		V t2 = x[2] + x[3];
+		V t3 = x[1] - x[4];
+		V t4 = x[2] - x[3];
+		V u1 = x[0] + V::scale(t1, COS72) + V::scale(t2, COS144);
+		V u2 = x[0] + V::scale(t1, COS144) + V::scale(t2, COS72);
+		V v1 = V::template rotate<inverse>(V::scale(t3, SIN72) + V::scale(t4, SIN144));
+		V v2 = V::template rotate<inverse>(V::scale(t3, SIN144) - V::scale(t4, SIN72));
+		x[0] = x[0] + t1 + t2;
+		x[1] = u1 + v1;
+		x[4] = u1 - v1;
+		x[2] = u2 + v2;
+		x[3] = u2 - v2;
+		break;
+	}
+	}
+}
+
+//One decimation in time pass. Combines radix length m transforms, stored consecutively, into each
+//length m*radix block. Input must already be in digit reversed order.
+template <class V, bool inverse, size_t radix> static void ditPass(TComplex *p, size_t N, size_t m, const TComplex *tw)
+{
+	const size_t L = radix * m;
+	V x[radix];
+	for (size_t s = 0; s < N; s += L)
+	{
+		TComplex *b = p + s;
+		for (size_t k = 0; k < m; k += V::width)
+		{
+			x[0] = V::load(b + k);
+			for (size_t q = 1; q < radix; q++)
+				x[q] = twiddleMul<V, inverse>(V::load(b + k + q * m), V::load(tw + (q - 1) * m + k));
+			dft<V, inverse, radix>(x);
+			for (size_t q = 0; q < radix; q++)
+				x[q].store(b + k + q * m);
+		}
+	}
+}
+
+//One decimation in frequency pass, the mirror of ditPass. Splits each length m*radix block into radix
+//length m transforms, leaving the output digit reversed. When conjugate is set, every input is first
+//multiplied by the conjugate of the matching sample of conjugate[] so a cross spectrum costs no extra pass.
+template <class V, bool inverse, size_t radix> static void difPass(TComplex *p, size_t N, size_t m, const TComplex *tw, const TComplex *conjugate)
+{
+	const size_t L = radix * m;
+	V x[radix];
+	for (size_t s = 0; s < N; s += L)
+	{
+		TComplex *b = p + s;
+		for (size_t k = 0; k < m; k += V::width)
+		{
+			for (size_t q = 0; q < radix; q++)
+			{
+				x[q] = V::load(b + k + q * m);
+				if (conjugate != NULL)
+					x[q] = V::mulConj(x[q], V::load(conjugate + s + k + q * m));
+			}
+			dft<V, inverse, radix>(x);
+			x[0].store(b + k);
+			for (size_t q = 1; q < radix; q++)
+				twiddleMul<V, inverse>(x[q], V::load(tw + (q - 1) * m + k)).store(b + k + q * m);
+		}
+	}
+}
+
+//Radix-4 passes carry nearly all the work, so they are written out by hand rather than left to the
+//compiler to unroll. Their blocks are kept in radix-2 order, block q holding DFT term 0, 2, 1, 3, which
+//is what lets radix-2 and radix-4 passes share the binary digit reversal.
+template <class V, bool inverse> static void ditPass4(TComplex *p, size_t N, size_t m, const TComplex *tw)
+{
+	const size_t L = 4 * m;
+	for (size_t s = 0; s < N; s += L)
+	{
+		TComplex *x = p + s;
+		for (size_t k = 0; k < m; k += V::width)
+		{
+			V a = V::load(x + k);
+			V b = twiddleMul<V, inverse>(V::load(x + k + m), V::load(tw + m + k));
+			V c = twiddleMul<V, inverse>(V::load(x + k + 2 * m), V::load(tw + k));
+			V d = twiddleMul<V, inverse>(V::load(x + k + 3 * m), V::load(tw + 2 * m + k));
+			V apb = a + b;
+			V amb = a - b;
+			V cpd = c + d;
+			V cmd = V::template rotate<inverse>(c - d);
+			(apb + cpd).store(x + k);
+			(amb + cmd).store(x + k + m);
+			(apb - cpd).store(x + k + 2 * m);
+			(amb - cmd).store(x + k + 3 * m);
+		}
+	}
+}
+
+template <class V, bool inverse> static void difPass4(TComplex *p, size_t N, size_t m, const TComplex *tw, const TComplex *conjugate)
+{
+	const size_t L = 4 * m;
+	for (size_t s = 0; s < N; s += L)
+	{
+		TComplex *x = p + s;
+		for (size_t k = 0; k < m; k += V::width)
+		{
+			V a = V::load(x + k);
+			V b = V::load(x + k + m);
+			V c = V::load(x + k + 2 * m);
+			V d = V::load(x + k + 3 * m);
+			if (conjugate != NULL)
+			{
+				const TComplex *y = conjugate + s;
+				a = V::mulConj(a, V::load(y + k));
+				b = V::mulConj(b, V::load(y + k + m));
+				c = V::mulConj(c, V::load(y + k + 2 * m));
+				d = V::mulConj(d, V::load(y + k + 3 * m));
+			}
+			V apc = a + c;
+			V amc = a - c;
+			V bpd = b + d;
+			V bmd = V::template rotate<inverse>(b - d);
+			(apc + bpd).store(x + k);
+			twiddleMul<V, inverse>(apc - bpd, V::load(tw + m + k)).store(x + k + m);
+			twiddleMul<V, inverse>(amc + bmd, V::load(tw + k)).store(x + k + 2 * m);
+			twiddleMul<V, inverse>(amc - bmd, V::load(tw + 2 * m + k)).store(x + k + 3 * m);
+		}
+	}
+}
+
+//Decimation in time pass for a prime radix above 5. Slow, O(N * radix), but keeps any size correct.
+template <bool inverse> static void ditGeneric(TComplex *p, const fftPlan *plan, size_t radix, size_t m, const TComplex *tw)
+{
+	const size_t N = plan->_N;
+	const size_t L = radix * m;
+	std::vector<cvecScalar> x(radix), y(radix);
+	for (size_t s = 0; s < N; s += L)
+	{
+		TComplex *b = p + s;
+		for (size_t k = 0; k < m; k++)
+		{
+			x[0] = cvecScalar::load(b + k);
+			for (size_t q = 1; q < radix; q++)
+				x[q] = twiddleMul<cvecScalar, inverse>(cvecScalar::load(b + k + q * m), cvecScalar::load(tw + (q - 1) * m + k));
+			for (size_t j = 0; j < radix; j++)
+			{
+				y[j] = x[0];
+				for (size_t q = 1; q < radix; q++)
+					y[j] = y[j] + twiddleMul<cvecScalar, inverse>(x[q], cvecScalar::load(&plan->_twiddle[((q * j) % radix) * (N / radix)]));
+			}
+			for (size_t j = 0; j < radix; j++)
+				y[j].store(b + k + j * m);
+		}
+	}
+}
+
+template <bool inverse> static void difGeneric(TComplex *p, const fftPlan *plan, size_t radix, size_t m, const TComplex *tw, const TComplex *conjugate = NULL)
+{
+	const size_t N = plan->_N;
+	const size_t L = radix * m;
+	std::vector<cvecScalar> x(radix), y(radix);
+	for (size_t s = 0; s < N; s += L)
+	{
+		TComplex *b = p + s;
+		for (size_t k = 0; k < m; k++)
+		{
+			for (size_t q = 0; q < radix; q++)
+			{
+				x[q] = cvecScalar::load(b + k + q * m);
+				if (conjugate != NULL)
+					x[q] = cvecScalar::mulConj(x[q], cvecScalar::load(conjugate + s + k + q * m));
+			}
+			for (size_t j = 0; j < radix; j++)
+			{
+				y[j] = x[0];
+				for (size_t q = 1; q < radix; q++)
+					y[j] = y[j] + twiddleMul<cvecScalar, inverse>(x[q], cvecScalar::load(&plan->_twiddle[((q * j) % radix) * (N / radix)]));
+			}
+			y[0].store(b + k);
+			for (size_t j = 1; j < radix; j++)
+				twiddleMul<cvecScalar, inverse>(y[j], cvecScalar::load(tw + (j - 1) * m + k)).store(b + k + j * m);
+		}
+	}
+}
+
+//Running magnitude sum and peak search over the correlation, fed four consecutive outputs at a time
+class peakSearch
+{
+public:
+	peakSearch()
+	{
+#if defined(__AVX2__) || defined(__AVX512F__)
+		_sum = _mm256_setzero_pd();
+		_max = _mm256_set1_pd(-1.0);
+		_pos = _mm256_setzero_pd();
+#endif
+	}
+	//norms of outputs at pos..pos+3
+	void add(const double *norm, size_t pos)
+	{
+#if defined(__AVX2__) || defined(__AVX512F__)
+		__m256d mag = _mm256_sqrt_pd(_mm256_loadu_pd(norm));
+		_sum = _mm256_add_pd(_sum, mag);
+		__m256d gt = _mm256_cmp_pd(mag, _max, _CMP_GT_OQ);
+		_max = _mm256_blendv_pd(_max, mag, gt);
+		_pos = _mm256_blendv_pd(_pos, _mm256_set1_pd(static_cast<double>(pos)), gt);
+#else
+		for (int i = 0; i < 4; i++)
+		{
+			double mag = sqrt(norm[i]);
+			_sum += mag;
+			if (mag > _max)
+			{
+				_max = mag;
+				_pos = pos + i;
+			}
+		}
+#endif
+	}
+	//norms of any number of outputs from pos on, used for the end of sizes that are not a multiple of four
+	void add(const double *norm, size_t count, size_t pos)
+	{
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+			add(norm + i, pos + i);
+		for (; i < count; i++)
+		{
+			double mag = sqrt(norm[i]);
+			_tailSum += mag;
+			if (mag > _tailMax)
+			{
+				_tailMax = mag;
+				_tailPos = pos + i;
+			}
+		}
+	}
+	void result(double &sum, double &max, size_t &pos)
+	{
+#if defined(__AVX2__) || defined(__AVX512F__)
+		double s[4], m[4], p[4];
+		_mm256_storeu_pd(s, _sum);
+		_mm256_storeu_pd(m, _max);
+		_mm256_storeu_pd(p, _pos);
+		sum = s[0] + s[1] + s[2] + s[3];
+		max = m[0];
+		pos = static_cast<size_t>(p[0]);
+		for (int i = 1; i < 4; i++)
+		{
+			if (m[i] > max || (m[i] == max && static_cast<size_t>(p[i]) + i < pos))
+			{
+				max = m[i];
+				pos = static_cast<size_t>(p[i]) + i;
+			}
+		}
+#else
+		sum = _sum;
+		max = _max;
+		pos = _pos;
+#endif
+		sum += _tailSum;
+		if (_tailMax > max)
+		{
+			max = _tailMax;
+			pos = _tailPos;
+		}
+	}
+private:
+#if defined(__AVX2__) || defined(__AVX512F__)
+	__m256d _sum;
+	__m256d _max;
+	__m256d _pos;
+#else
+	double _sum = { 0 };
+	double _max = { -1 };
+	size_t _pos = { 0 };
+#endif
+	double _tailSum = { 0 };
+	double _tailMax = { -1 };
+	size_t _tailPos = { 0 };
+};
+
+//Run a pass with the widest vector that divides the butterfly count
+template <bool inverse, size_t radix> static void ditPass(TComplex *p, const fftPlan *plan, const fftPlan::stage &st)
+{
+	const TComplex *tw = &plan->_stageTwiddle[0] + st.offset;
+	if (radix == 4 && st.m % cvecWide::width == 0)
+		ditPass4<cvecWide, inverse>(p, plan->_N, st.m, tw);
+	else if (radix == 4)
+		ditPass4<cvecScalar, inverse>(p, plan->_N, st.m, tw);
+	else if (st.m % cvecWide::width == 0)
+		ditPass<cvecWide, inverse, radix>(p, plan->_N, st.m, tw);
+	else
+		ditPass<cvecScalar, inverse, radix>(p, plan->_N, st.m, tw);
+}
+
+template <bool inverse> static void ditPass(TComplex *p, const fftPlan *plan, const fftPlan::stage &st)
+{
+	switch (st.radix)
+	{
+	case 2: ditPass<inverse, 2>(p, plan, st); break;
+	case 3: ditPass<inverse, 3>(p, plan, st); break;
+	case 4: ditPass<inverse, 4>(p, plan, st); break;
+	case 5: ditPass<inverse, 5>(p, plan, st); break;
+	default: ditGeneric<inverse>(p, plan, st.radix, st.m, &plan->_stageTwiddle[0] + st.offset); break;
+	}
+}
+
+template <bool inverse, size_t radix> static void difPass(TComplex *p, const fftPlan *plan, const fftPlan::stage &st, const TComplex *conjugate)
+{
+	const TComplex *tw = &plan->_stageTwiddle[0] + st.offset;
+	if (radix == 4 && st.m % cvecWide::width == 0)
+		difPass4<cvecWide, inverse>(p, plan->_N, st.m, tw, conjugate);
+	else if (radix == 4)
+		difPass4<cvecScalar, inverse>(p, plan->_N, st.m, tw, conjugate);
+	else if (st.m % cvecWide::width == 0)
+		difPass<cvecWide, inverse, radix>(p, plan->_N, st.m, tw, conjugate);
+	else
+		difPass<cvecScalar, inverse, radix>(p, plan->_N, st.m, tw, conjugate);
+}
+
+template <bool inverse> static void difPass(TComplex *p, const fftPlan *plan, const fftPlan::stage &st, const TComplex *conjugate = NULL)
+{
+	switch (st.radix)
+	{
+	case 2: difPass<inverse, 2>(p, plan, st, conjugate); break;
+	case 3: difPass<inverse, 3>(p, plan, st, conjugate); break;
+	case 4: difPass<inverse, 4>(p, plan, st, conjugate); break;
+	case 5: difPass<inverse, 5>(p, plan, st, conjugate); break;
+	default: difGeneric<inverse>(p, plan, st.radix, st.m, &plan->_stageTwiddle[0] + st.offset, conjugate); break;
+	}
+}
+
+//Final inverse pass of a correlation when it is radix 2 or 4 and the size is a multiple of four, which covers
+//every even 2/3/5 size but those with a single factor of two. It has m = 1 and so no twiddles, and its outputs
+//only feed the peak search so are never written back.
+static void lastPass(const TComplex *p, size_t N, size_t radix, double &sum, double &max, size_t &pos)
+{
+	peakSearch search;
+	double norm[4];
+	for (size_t s = 0; s < N; s += 4)
+	{
+		const TComplex *x = p + s;
+		cvecScalar a = cvecScalar::load(x), b = cvecScalar::load(x + 1), c = cvecScalar::load(x + 2), d = cvecScalar::load(x + 3);
+		if (radix == 4)
+		{
+			cvecScalar apc = a + c, amc = a - c, bpd = b + d;
+			cvecScalar bmd = cvecScalar::rotate<true>(b - d);
+			cvecScalar y0 = apc + bpd, y1 = apc - bpd, y2 = amc + bmd, y3 = amc - bmd;
+			norm[0] = y0.norm();
+			norm[1] = y1.norm();
+			norm[2] = y2.norm();
+			norm[3] = y3.norm();
+		}
+		else
+		{
+			//Two radix-2 butterflies
+			cvecScalar y0 = a + b, y1 = a - b, y2 = c + d, y3 = c - d;
+			norm[0] = y0.norm();
+			norm[1] = y1.norm();
+			norm[2] = y2.norm();
+			norm[3] = y3.norm();
+		}
+		search.add(norm, s);
+	}
+	search.result(sum, max, pos);
+}
+
+//Correlation of the cross spectrum slave * conj(master) at a fractional lag tau in samples, with its first
+//and second derivatives. This is the band limited interpolant of the correlation, so sampling it is
+//equivalent to upsampling without limit, but costs only O(N) per point.
+static void correlationAt(const TComplex *slave, const TSignal &master, double tau,
+	std::complex<double> &c, std::complex<double> &c1, std::complex<double> &c2)
+{
+	const size_t N = master.size();
+	const size_t half = (N + 1) / 2;
+	const std::complex<double> step = std::polar(1.0, 2 * M_PI * tau / N);
+	std::complex<double> e;
+	c = c1 = c2 = 0;
+	for (size_t k = 0; k < N; k++)
+	{
+		//Signed frequency in radians per sample. The phasor is advanced by multiplication and
+		//recomputed every so often, and at the wrap to negative frequencies, to bound rounding.
+		double f = k < half ? static_cast<double>(k) : static_cast<double>(k) - static_cast<double>(N);
+		double w = 2 * M_PI * f / N;
+		if (k % 64 == 0 || k == half)
+			e = std::polar(1.0, w * tau);
+		std::complex<double> x = std::complex<double>(slave[k]) * std::conj(std::complex<double>(master[k])) * e;
+		c += x;
+		c1 += std::complex<double>(0, w) * x;
+		c2 -= w * w * x;
+		e *= step;
+	}
+}
+
+//Working buffers for the correlation, one set per thread and kept from call to call, so once they have
+//grown to the capture length correlating allocates nothing
+struct correlationScratch
+{
+	std::vector<double> norm;
+	std::vector<std::complex<double>> chirp;
+	TSignal a, b;
+	std::vector<TComplex> spectrum;
+};
+
+static correlationScratch &scratch()
+{
+	thread_local correlationScratch buffers;
+	return buffers;
+}
+
+//Full circular correlation of the fused kernel: ifft(slave * conj(master)) in one pass per factor. The
+//conjugate multiply rides on the first decimation in frequency pass and the magnitude, peak and mean are
+//taken inside the last pass, so the digit reversal, shift and magnitude arrays are never built. Slave is
+//overwritten.
+void fft::correlateAll(const TSignal &master, TSignal &slave, double &sum, double &max, int32_t &offset)
+{
+	const size_t N = slave.size();
+	const fftPlan *plan = fftPlan::get(N);
+	TComplex *p = &slave[0];
+	const TComplex *conjugate = &master[0];
+
+	//Passes largest first, stopping short of the final pass which is fused with the peak search
+	for (size_t i = plan->_stages.size() - 1; i > 0; i--)
+	{
+		difPass<true>(p, plan, plan->_stages[i], conjugate);
+		conjugate = NULL;
+	}
+	if (conjugate != NULL)
+	{
+		for (size_t i = 0; i < N; i++)
+			cvecScalar::mulConj(cvecScalar::load(p + i), cvecScalar::load(conjugate + i)).store(p + i);
+	}
+
+	size_t pos;
+	const size_t radix = plan->_stages[0].radix;
+	if ((radix == 2 || radix == 4) && N % 4 == 0)
+		lastPass(p, N, radix, sum, max, pos);
+	else
+	{
+		difPass<true>(p, plan, plan->_stages[0]);
+		std::vector<double> &norm = scratch().norm;
+		norm.resize(N);
+		for (size_t i = 0; i < N; i++)
+			norm[i] = cvecScalar::load(p + i).norm();
+		peakSearch search;
+		search.add(&norm[0], N, 0);
+		search.result(sum, max, pos);
+	}
+	//Outputs are in digit reversed order. Lags beyond N/2 are negative.
+	size_t lag = plan->_digitrev[pos];
+	offset = lag < (N + 1) / 2 ? static_cast<int32_t>(lag) : static_cast<int32_t>(lag) - static_cast<int32_t>(N);
+}
+
+//True if n factors into 2, 3 and 5 only
+static bool smooth(size_t n)
+{
+	for (size_t f : { 2, 3, 5 })
+	{
+		while (n > 1 && n % f == 0)
+			n /= f;
+	}
+	return n == 1;
+}
+
+//exp(i*pi*t^2/N) for t = 0..count-1, the chirp of the chirp-z transform. Built by recurrence, each step
+//multiplying by exp(i*pi*(2t+1)/N), and recomputed exactly every so often with t^2 reduced modulo 2N so the
+//phase stays accurate.
+static void chirp(size_t N, size_t count, std::vector<std::complex<double>> &w)
+{
+	w.resize(count);
+	const std::complex<double> step = std::polar(1.0, 2 * M_PI / N);
+	std::complex<double> ratio;
+	for (size_t t = 0; t < count; t++)
+	{
+		if (t % 256 == 0)
+		{
+			uint64_t r = (static_cast<uint64_t>(t) * t) % (2 * N);
+			w[t] = std::polar(1.0, M_PI * static_cast<double>(r) / N);
+			ratio = std::polar(1.0, M_PI * static_cast<double>((2 * t + 1) % (2 * N)) / N);
+		}
+		else
+		{
+			w[t] = w[t - 1] * ratio;
+			ratio *= step;
+		}
+	}
+}
+
+//Correlation over lags -maxLag..maxLag only. Only the occupied band of the cross spectrum is used, which
+//for upsampled captures is a small fraction of it, and its inverse DFT at just those lags is taken by
+//chirp-z transform: three FFTs whose length is the band plus the window rather than one of the whole
+//spectrum. Returns false, leaving the full correlation to be taken instead, when that would not be cheaper.
+//sum is an estimate of the magnitude summed over every lag so the peak to mean ratio matches the full
+//correlation.
+bool fft::correlateWindow(const TSignal &master, const TSignal &slave, int32_t maxLag, double &sum, double &max, int32_t &offset)
+{
+	const size_t N = slave.size();
+	const size_t L = static_cast<size_t>(maxLag);
+	const size_t M = 2 * L + 1;
+	if (M >= N)
+		return false;
+	//The occupied band is everything outside the longest circular run of empty bins. The run that wraps
+	//round is the leading and trailing runs together.
+	const TComplex *s = &slave[0];
+	const TComplex *m = &master[0];
+	size_t leading = N, run = 0, longest = 0, longestEnd = 0;
+	for (size_t k = 0; k < N; k++)
+	{
+		if (s[k] == TComplex(0) || m[k] == TComplex(0))
+		{
+			if (++run > longest)
+			{
+				longest = run;
+				longestEnd = k;
+			}
+		}
+		else
+		{
+			if (leading == N)
+				leading = k;
+			run = 0;
+		}
+	}
+	if (leading == N)
+		return false;
+	if (leading + run > longest)
+	{
+		longest = leading + run;
+		longestEnd = leading - 1 + N;
+	}
+	const size_t B = N - longest;
+	const size_t k0 = (longestEnd + 1) % N;
+	size_t P = B + M - 1;
+	while (!smooth(P))
+		P++;
+	if (3 * P >= N)
+		return false;
+
+	//c(n - L) = sum over j < B of X(k0 + j) exp(2*pi*i*(k0 + j)*(n - L)/N) for n < M, X = slave * conj(master).
+	//Writing 2*j*n = j^2 + n^2 - (n - j)^2 turns the sum into a convolution of X(k0 + j) * chirp(j - L) with
+	//conj(chirp(t)). Only the magnitude is wanted, so unit modulus factors outside the sum are dropped.
+	correlationScratch &buffers = scratch();
+	std::vector<std::complex<double>> &w = buffers.chirp;
+	chirp(N, std::max(M, B + L), w);
+	TSignal &a = buffers.a, &b = buffers.b;
+	if (a.size() != P)
+	{
+		a.resize(P);
+		b.resize(P);
+	}
+	a = TComplex(0);
+	b = TComplex(0);
+	double total = 0;
+	for (size_t j = 0; j < B; j++)
+	{
+		size_t k = (k0 + j) % N;
+		std::complex<double> x = std::complex<double>(s[k]) * std::conj(std::complex<double>(m[k]));
+		total += std::norm(x);
+		a[j] = TComplex(x * (j >= L ? w[j - L] : w[L - j]));
+	}
+	for (size_t t = 0; t < M; t++)
+		b[t] = TComplex(std::conj(w[t]));
+	for (size_t t = 1; t < B; t++)
+		b[P - t] = TComplex(std::conj(w[t]));
+	transform(a);
+	transform(b);
+	for (size_t i = 0; i < P; i++)
+		cvecScalar::mul(cvecScalar::load(&a[i]), cvecScalar::load(&b[i])).store(&a[i]);
+	//Unscaled inverse, the 1/P is applied to the few magnitudes wanted instead
+	butterflies(a, true);
+
+	sum = 0;
+	max = -1;
+	size_t pos = 0;
+	double energy = 0;
+	for (size_t n = 0; n < M; n++)
+	{
+		double mag = sqrt(std::norm(a[n])) / P;
+		sum += mag;
+		energy += mag * mag;
+		if (mag > max)
+		{
+			max = mag;
+			pos = n;
+		}
+	}
+	offset = static_cast<int32_t>(pos) - maxLag;
+
+	//The mean over all lags, as the full correlation would give, is still wanted as a quality measure. By
+	//Parseval the energy of all lags is N times that of the cross spectrum, so the energy of the lags outside
+	//the window is known exactly. They are far from the peak and so noise like, with Rayleigh distributed
+	//magnitudes whose mean is sqrt(pi)/2 of their rms.
+	double outside = std::max(0.0, N * total - energy);
+	sum += (N - M) * 0.5 * sqrt(M_PI * outside / (N - M));
+	return true;
+}
+
+//Cross correlate two spectra, slave * conj(master), and find the peak. With maxLag set only the lags within
+//it are evaluated, otherwise the full circular correlation is taken and slave is overwritten. With
+//refinement the spectra are expected at the capture rate, rather than upsampled, and the peak lag is
+//refined to a fraction of a sample in result.delay.
+void fft::correlate(const TSignal &master, TSignal &slave, correlationPeak &result, peakRefinement refine, int32_t maxLag)
+{
+	const size_t N = slave.size();
+	result.offset = 0;
+	result.delay = 0;
+	result.peak = 0;
+	result.peakToMean = 0;
+	if (N < 2 || master.size() != N)
+		return;
+	double sum, max;
+	std::vector<TComplex> &spectrum = scratch().spectrum;
+	const TComplex *cross = &slave[0];
+	if (maxLag <= 0 || !correlateWindow(master, slave, maxLag, sum, max, result.offset))
+	{
+		//Refinement evaluates the correlation directly so needs the slave spectrum before it is overwritten
+		if (refine != REFINE_NONE)
+		{
+			spectrum.assign(std::begin(slave), std::end(slave));
+			cross = &spectrum[0];
+		}
+		correlateAll(master, slave, sum, max, result.offset);
+	}
+	result.delay = result.offset;
+	const double mean = sum / N;
+
+	std::complex<double> c, c1, c2;
+	if (refine == REFINE_PARABOLIC && N >= 3)
+	{
+		//Vertex of the parabola through the magnitudes either side of the peak
+		correlationAt(cross, master, result.offset - 1.0, c, c1, c2);
+		double before = std::abs(c);
+		correlationAt(cross, master, result.offset + 1.0, c, c1, c2);
+		double after = std::abs(c);
+		double curvature = before - 2 * max + after;
+		if (curvature < 0)
+		{
+			double delta = 0.5 * (before - after) / curvature;
+			result.delay += delta;
+			max -= 0.25 * (before - after) * delta;
+		}
+	}
+	else if (refine == REFINE_ZOOM)
+	{
+		//Newton's method on |c(tau)|^2 starting from the whole sample peak. The step is limited to half
+		//a sample so it cannot walk off onto a neighbouring sidelobe.
+		double tau = result.offset;
+		for (int i = 0; i < 8; i++)
+		{
+			correlationAt(cross, master, tau, c, c1, c2);
+			double slope = 2 * (c1 * std::conj(c)).real();
+			double curvature = 2 * (std::norm(c1) + (c2 * std::conj(c)).real());
+			if (curvature >= 0)
+				break;
+			double step = std::max(-0.5, std::min(0.5, -slope / curvature));
+			tau += step;
+			if (std::abs(step) < 1e-4)
+				break;
+		}
+		correlationAt(cross, master, tau, c, c1, c2);
+		if (std::abs(c) >= max && std::abs(tau - result.offset) <= 1)
+		{
+			result.delay = tau;
+			max = std::abs(c);
+		}
+	}
+	result.peak = max / N;
+	result.peakToMean = mean > 0 ? max / mean : 0;
+}
+
+//Refinement named in the configuration, "upsample" (the default), "parabolic" or "zoom"
+peakRefinement fft::refinement(const std::string &name)
+{
+	if (name == "parabolic")
+		return REFINE_PARABOLIC;
+	if (name == "zoom")
+		return REFINE_ZOOM;
+	return REFINE_NONE;
+}
+
+//Largest size not above n that factors into 2, 3 and 5 only and is even, so a capture can be cut to a
+//length the FFT handles at full speed while losing as few samples as possible
+size_t fft::goodSize(size_t n)
+{
+	for (; n > 2; n--)
+	{
+		if (n % 2 == 0 && smooth(n))
+			return n;
+	}
+	return n;
+}
+
 #ifndef IPP
 // CooleyTukey FFT (in-place)
 void fft::coolytukey(TSignal &x)
 {
-    const size_t N = x.size();
-    if(N/2 > twiddle.size())
-    {
-	    //cout << "computing twiddle" << endl;
-	    //recompute twiddle factors
-	    twiddle.resize(N/2);
-	    for(size_t k = 0; k < N/2; ++k)
-	    {
-		    twiddle[k] = std::polar<double>(1.0, -2 * M_PI * k / N);
-	    }
-    }
-    if (N <= 1)
-    {
-	    return;
-    }
-    // divide
-    valarray<complex<double>> even = x[std::slice(0, N/2, 2)];
-    valarray<complex<double>>  odd = x[std::slice(1, N/2, 2)];
- 
-	valarray<complex<double>>  *p1 = &x;
-	valarray<complex<double>>  *p2 = &even;
+	butterflies(x, false);
+}
 
-    // conquer
-    transform(even);
-    transform(odd);
- 
-    // combine
-	size_t step = 2 * twiddle.size() / N;
-    for (size_t i = 0, k = 0; k < N/2; ++k, i += step)
-    {
-		complex<double> t = twiddle[i] * odd[k];
-        x[k    ] = even[k] + t;
-        x[k+N/2] = even[k] - t;
-    }
+//Iterative mixed radix decimation in time. The input is permuted in place into digit reversed order
+//and then combined by one pass per factor (2, 4, 3, 5 or any larger prime). Tables come from the shared
+//plan for this size so nothing is allocated per call.
+void fft::butterflies(TSignal &x, bool inverse)
+{
+	const size_t N = x.size();
+	if (N <= 1)
+	{
+		return;
+	}
+	const fftPlan *plan = fftPlan::get(N);
+	TComplex *p = &x[0];
+	const uint32_t *rev = &plan->_digitrev[0];
+
+	//digit reversal permutation, following each cycle from its first position
+	for (uint32_t start : plan->_cycles)
+	{
+		TComplex first = p[start];
+		size_t i = start;
+		for (size_t next = rev[i]; next != start; i = next, next = rev[i])
+			p[i] = p[next];
+		p[i] = first;
+	}
+
+	for (const fftPlan::stage &st : plan->_stages)
+	{
+		if (inverse)
+			ditPass<true>(p, plan, st);
+		else
+			ditPass<false>(p, plan, st);
+	}
 }
 
 #else
@@ -237,7 +1064,7 @@ void fft::coolytukey(TSignal &x)
 	ippsFree(pSrc);
 	for (size_t i = 0; i < N; i++)
 	{
-		x[i] = std::complex<double>(pDst[i].re, pDst[i].im);
+		x[i] = TComplex(pDst[i].re, pDst[i].im);
 	}
 	ippsFree(pDst);
 }
@@ -246,20 +1073,19 @@ void fft::coolytukey(TSignal &x)
 // inverse fft (in-place)
 void fft::invert(TSignal &x)
 {
+#ifndef IPP
+	//Run the butterflies with conjugated twiddles rather than conjugating the data twice
+	butterflies(x, true);
+#else
     // conjugate the complex numbers
 	x = x.apply(std::conj);
-	//for(size_t i = 0;i < x.size();i++)
-	//	x[i] = std::conj(x[i]);
 
     // forward fft
     transform(x);
  
     // conjugate the complex numbers again
 	x = x.apply(std::conj);
-	//for(size_t i = 0;i < x.size();i++)
-	//	x[i] = std::conj(x[i]);
+#endif
     //scale the numbers
     x /= static_cast<double>(x.size());
 }
-
-
@@ -7,16 +7,66 @@
 #include <complex>
 #include <valarray>
 #include <vector>
+#include <string>
 #include <iostream>
 #include <fstream>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #ifdef IPP
 #include <ipps.h>
 #endif
 
 #define FFT_SIZE(x) (static_cast<int>(pow(2,ceil(log2(static_cast<double>(x))))))
 
-typedef std::valarray<std::complex<double>> TSignal;
+//Precision of the capture, FFT and correlation path. Samples arrive as int16 I/Q so single precision
+//loses nothing measurable while halving memory traffic and doubling SIMD width. Build with
+//SINGLE_PRECISION defined to select it.
+#ifdef SINGLE_PRECISION
+typedef float TSample;
+#else
+typedef double TSample;
+#endif
+typedef std::complex<TSample> TComplex;
+typedef std::valarray<TComplex> TSignal;
+
+//Precomputed tables for one transform size. Plans are built once, never modified and shared by
+//every thread, so the FFT itself holds no mutable state.
+class fftPlan
+{
+public:
+	static const fftPlan *get(size_t N);
+	struct stage { size_t radix; size_t m; size_t offset; };	//one pass: radix, sub-transform length, twiddle offset
+	size_t _N;
+	std::vector<TComplex> _twiddle;				//exp(-2*pi*i*k/N) for k = 0..N-1
+	std::vector<stage> _stages;					//passes in decimation in time order, smallest first
+	std::vector<TComplex> _stageTwiddle;			//per pass twiddles, laid out for vector loads
+	std::vector<uint32_t> _digitrev;				//sample held at each position of the digit reversed order
+	std::vector<uint32_t> _cycles;					//first position of each cycle of that permutation
+private:
+	explicit fftPlan(size_t N);
+	const fftPlan *_next = { NULL };				//registry is a singly linked list, newest first
+	static std::atomic<const fftPlan *> _head;
+	static std::mutex _mtx;
+	static std::vector<std::unique_ptr<fftPlan>> _owner;
+};
+
+//How fft::correlate resolves the peak below one sample
+enum peakRefinement
+{
+	REFINE_NONE,			//whole samples only, resolution comes from upsampling the spectra beforehand
+	REFINE_PARABOLIC,		//parabola through the peak and its two neighbours
+	REFINE_ZOOM				//maximise the band limited correlation near the peak, evaluated directly from the cross spectrum
+};
+
+//Correlation peak as returned by fft::correlate
+struct correlationPeak
+{
+	int32_t offset;			//lag of the peak in samples, negative if the slave leads the master
+	double delay;			//lag of the peak in samples including any sub-sample refinement
+	double peak;			//correlation magnitude at the peak
+	double peakToMean;		//peak over mean magnitude, a measure of correlation quality
+};
 
 class fft
 {
@@ -31,14 +81,19 @@ public:
 	void transform(std::vector<double> &real, std::vector<double> &imag);
 	void invert(std::vector<double> &real, std::vector<double> &imag);
 	void blackmanHarris(TSignal &x);
+	void correlate(const TSignal &master, TSignal &slave, correlationPeak &result, peakRefinement refine = REFINE_NONE, int32_t maxLag = 0);
+	static size_t goodSize(size_t n);
+	static peakRefinement refinement(const std::string &name);
 	TSignal spectrum;
 	void coolytukey(TSignal &x);
 private:
+	void butterflies(TSignal &x, bool inverse);
+	void correlateAll(const TSignal &master, TSignal &slave, double &sum, double &max, int32_t &offset);
+	bool correlateWindow(const TSignal &master, const TSignal &slave, int32_t maxLag, double &sum, double &max, int32_t &offset);
 
 	unsigned int m_logN;
 	unsigned int m_N;
 	TSignal *m_valarray;
-	TSignal twiddle;
 	std::mutex m_mtx;
 };
 
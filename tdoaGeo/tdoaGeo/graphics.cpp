@@ -82,7 +82,7 @@ private:
 
 };
 
-bool graphics::plotResult(tdoaResult *result)
+bool graphics::plotResult(const tdoaResult *result)
 {
 	bool open = _window != NULL && _window->isOpen();
 	if (open)
@@ -97,8 +97,11 @@ bool graphics::plotResult(tdoaResult *result)
 			double minLat = 90;
 			double maxLon = -180;
 			double minLon = +180;
-			for (auto n : result->_nodes)
+			//Points come as earth centred, only drawing needs them in latitude and longitude
+			location n;
+			for (auto &p : result->_nodes)
 			{
+				n.setCartesian(p);
 				n.getLatLong(coords);
 				maxLat = std::max(maxLat, coords[LAT]);
 				maxLon = std::max(maxLon, coords[LON]);
@@ -115,31 +118,53 @@ bool graphics::plotResult(tdoaResult *result)
 			double distance = l1.distance(l2);
 			double m_pix = l1.distance(l2) / ((_scale * pixels.y * (maxLat - yoffset) / yscale) - (_scale * pixels.y * (minLat - yoffset) / yscale));
 
+			//Colour by error relative to the largest valid one
 			double maxHeatmap = 0;
-			for (auto l : result->_heatmap)
+			for (auto e : result->_heatmap._error)
+			{
+				if (e < FLT_MAX)
+					maxHeatmap = std::max(maxHeatmap, static_cast<double>(e));
+			}
+			for (auto &l : result->_visited)
 				maxHeatmap = std::max(maxHeatmap, l._error);
 
-			for (auto l : result->_heatmap)
+			auto spot = [&](const location &l, double error)
 			{
 				l.getLatLong(coords);
 				float y = _scale * pixels.y * (coords[LAT] - yoffset) / yscale;
 				float x = _scale * pixels.x * (coords[LON] - xoffset) / xscale;
 				sf::CircleShape shape(3);
-				colour rgb(1.0 - (l._error / maxHeatmap));
+				colour rgb(1.0 - (error / maxHeatmap));
 				shape.setFillColor(sf::Color(rgb._red, rgb._green, rgb._blue));
 				shape.setPosition((pixels.x / 2) + x, (pixels.y / 2) - y);
 				shape.setOrigin(shape.getRadius(), shape.getRadius());
 				_window->draw(shape);
+			};
+			const heatRaster &map = result->_heatmap;
+			for (size_t row = 0; row < map._rows; row++)
+			{
+				for (size_t column = 0; column < map._columns; column++)
+				{
+					float error = map._error[row * map._columns + column];
+					if (error < FLT_MAX)
+						spot(map._frame.toLocation(map.cell(column, row)), error);
+				}
+			}
+			for (auto &l : result->_visited)
+			{
+				n.setCartesian(l._position);
+				spot(n, l._error);
 			}
 			//Draw a square for each of the nodes
-			for (auto n : result->_nodes)
+			for (size_t i = 0; i < result->_nodes.size(); i++)
 			{
+				n.setCartesian(result->_nodes[i]);
 				n.getLatLong(coords);
 				float y = _scale * pixels.y * (coords[LAT] - yoffset) / yscale;
 				float x = _scale * pixels.x * (coords[LON] - xoffset) / xscale;
 				//sf::CircleShape symbol(3);
 				sf::RectangleShape symbol(sf::Vector2f(10, 10));
-				if (n == result->_nodes.front())
+				if (i == 0)
 					symbol.setFillColor(sf::Color::White);
 				else
 					symbol.setFillColor(sf::Color::Black);
@@ -199,13 +224,13 @@ bool graphics::drawSignal(TSignal &s)
 			_window->clear(sf::Color::Blue);
 			sf::Vector2u pixels = _window->getSize();
 
-			double max = std::abs(s[0]);
+			TSample max = std::abs(s[0]);
 			for (size_t i = 0; i < s.size(); i++)
 				max = std::max(max, std::abs(s[i]));
 
 			TSignal y = s;
-			y *= -0.4 * (static_cast<double>(pixels.y) / max);
-			y += std::complex<double>(pixels.y / 2, pixels.y / 2);
+			y *= static_cast<TSample>(-0.4 * (static_cast<double>(pixels.y) / max));
+			y += TComplex(static_cast<TSample>(pixels.y / 2), static_cast<TSample>(pixels.y / 2));
 
 			double xdelta = static_cast<double>(pixels.x) / static_cast<double>(y.size());
 			for (int i = 0; i < y.size(); i++)
@@ -239,7 +264,7 @@ bool graphics::drawSignal(std::vector<double> &v)
 	TSignal s(v.size());
 	for (size_t i = 0; i < v.size(); i++)
 	{
-		s[i] = std::complex<double>(v[i], 0.0);
+		s[i] = TComplex(static_cast<TSample>(v[i]), 0);
 	}
 	return drawSignal(s);
 }
@@ -9,7 +9,7 @@ class graphics
 public:
 	graphics(uint32_t x, uint32_t y);
 	~graphics();
-	bool plotResult(tdoaResult *result);
+	bool plotResult(const tdoaResult *result);
 	bool drawSignal(TSignal &s);
 	bool drawSignal(std::vector<double> &v);
 	private:
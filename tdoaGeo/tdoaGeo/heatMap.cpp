@@ -0,0 +1,121 @@
+#include "heatMap.h"
+#include "threadPool.h"
+#include <limits>
+#include <algorithm>
+#include <future>
+
+void heatMap::configure(double size, double spacing, size_t coarse)
+{
+	_size = size;
+	_spacing = spacing;
+	_coarse = std::max<size_t>(coarse, 1);
+}
+
+//The cost's invalid value doesn't fit in a float
+static float toFloat(double rms)
+{
+	return rms >= FLT_MAX ? FLT_MAX : static_cast<float>(rms);
+}
+
+void heatMap::build(const tdoaCost &cost, const enuFrame &frame, const point3 &centre, double level, heatRaster &map) const
+{
+	const double spacing = _spacing > 0 ? _spacing : 1;
+	const size_t cells = std::max<size_t>(1, static_cast<size_t>(std::lround(_size / spacing)));
+	const size_t coarse = std::min(_coarse, cells);
+	const size_t blocks = (cells + coarse - 1) / coarse;
+	map._frame = frame;
+	map._spacing = spacing;
+	map._columns = cells;
+	map._rows = cells;
+	map._east = centre.x - (cells - 1) * spacing / 2;
+	map._north = centre.y - (cells - 1) * spacing / 2;
+	map._height = centre.z - enuFrame::surface(centre.x, centre.y);
+	map._error.assign(cells * cells, FLT_MAX);
+
+	//Coarse grid at the middle of each block, in cells from the south west one
+	const double middle = (coarse - 1) / 2.0;
+	std::vector<double> rough(blocks * blocks, 0);
+	std::vector<char> refine(blocks * blocks, 1);
+	if (coarse > 1)
+	{
+		pointBatch points;
+		points.resize(3, blocks * blocks);
+		for (size_t bj = 0; bj < blocks; bj++)
+		{
+			for (size_t bi = 0; bi < blocks; bi++)
+			{
+				double x = map._east + (bi * coarse + middle) * spacing;
+				double y = map._north + (bj * coarse + middle) * spacing;
+				points.coord[X][bj * blocks + bi] = x;
+				points.coord[Y][bj * blocks + bi] = y;
+				points.coord[Z][bj * blocks + bi] = enuFrame::surface(x, y) + map._height;
+			}
+		}
+		cost.evaluate(points, &rough[0]);
+		//Refine where the block or one next to it is under the level, so the edge of the region is caught
+		for (size_t bj = 0; bj < blocks; bj++)
+		{
+			for (size_t bi = 0; bi < blocks; bi++)
+			{
+				bool low = false;
+				for (size_t j = bj > 0 ? bj - 1 : 0; j <= std::min(bj + 1, blocks - 1) && !low; j++)
+				{
+					for (size_t i = bi > 0 ? bi - 1 : 0; i <= std::min(bi + 1, blocks - 1) && !low; i++)
+						low = rough[j * blocks + i] < level;
+				}
+				refine[bj * blocks + bi] = low;
+			}
+		}
+	}
+
+	//Each band of blocks writes only its own rows
+	auto band = [&, coarse, blocks, cells, middle](size_t bj)
+	{
+		const size_t first = bj * coarse, last = std::min(first + coarse, cells);
+		pointBatch points;
+		points.resize(3, 0);
+		std::vector<size_t> index;
+		for (size_t row = first; row < last; row++)
+		{
+			for (size_t column = 0; column < cells; column++)
+			{
+				if (refine[bj * blocks + column / coarse])
+				{
+					point3 p = map.cell(column, row);
+					points.coord[X].push_back(p.x);
+					points.coord[Y].push_back(p.y);
+					points.coord[Z].push_back(p.z);
+					index.push_back(row * cells + column);
+					continue;
+				}
+				//Bilinear between the middles of the blocks round it, or the nearest if any of them is invalid
+				double u = std::min(std::max((column - middle) / coarse, 0.0), blocks - 1.0);
+				double v = std::min(std::max((row - middle) / coarse, 0.0), blocks - 1.0);
+				size_t i0 = static_cast<size_t>(u), j0 = static_cast<size_t>(v);
+				size_t i1 = std::min(i0 + 1, blocks - 1), j1 = std::min(j0 + 1, blocks - 1);
+				double fu = u - i0, fv = v - j0;
+				double r00 = rough[j0 * blocks + i0], r10 = rough[j0 * blocks + i1];
+				double r01 = rough[j1 * blocks + i0], r11 = rough[j1 * blocks + i1];
+				double value;
+				if (std::max(std::max(r00, r10), std::max(r01, r11)) == std::numeric_limits<double>::max())
+					value = rough[(fv < 0.5 ? j0 : j1) * blocks + (fu < 0.5 ? i0 : i1)];
+				else
+					value = (r00 * (1 - fu) + r10 * fu) * (1 - fv) + (r01 * (1 - fu) + r11 * fu) * fv;
+				map._error[row * cells + column] = toFloat(value);
+			}
+		}
+		if (index.empty())
+			return;
+		points.count = index.size();
+		std::vector<double> rms(index.size());
+		cost.evaluate(points, &rms[0]);
+		for (size_t k = 0; k < index.size(); k++)
+			map._error[index[k]] = toFloat(rms[k]);
+	};
+	ThreadPool &pool = ThreadPool::shared();
+	std::vector<std::future<void>> bands;
+	for (size_t bj = 0; bj < blocks; bj++)
+		bands.push_back(pool.submit([&band, bj]() { band(bj); }));
+	for (auto &b : bands)
+		pool.wait(b);
+}
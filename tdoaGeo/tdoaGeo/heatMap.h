@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <cfloat>
+#include "location.h"
+#include "tdoaCost.h"
+
+//The rms error over a square of ground round a fix. Cells are a regular grid in east and north of the
+//frame it was solved in, so going from a cell to its position needs no trigonometry.
+struct heatRaster
+{
+	enuFrame _frame;						//frame the grid lies in
+	double _east = { 0 };					//centre of the south west cell, m
+	double _north = { 0 };
+	double _height = { 0 };					//of every cell above the surface, m
+	double _spacing = { 0 };				//between cell centres, m
+	size_t _columns = { 0 };				//east
+	size_t _rows = { 0 };					//north
+	std::vector<float> _error;				//ns, row major from the south west. FLT_MAX where the cost isn't valid.
+	bool empty() const { return _error.empty(); };
+	//Centre of a cell in _frame
+	point3 cell(size_t column, size_t row) const
+	{
+		point3 p;
+		p.x = _east + column * _spacing;
+		p.y = _north + row * _spacing;
+		p.z = enuFrame::surface(p.x, p.y) + _height;
+		return p;
+	};
+};
+
+//Fills a heatRaster from a cohort's cost. The error is first taken on a grid coarse times wider, in one
+//batch. Only blocks of coarse x coarse cells where it, or that of a neighbouring block, is under the
+//level of interest are then evaluated in full; elsewhere the coarse grid is interpolated. Bands of blocks
+//are done on the pool, each evaluated as one batch.
+class heatMap
+{
+public:
+	heatMap() {};
+	~heatMap() {};
+	//Size of the square and the distance between cells in m. coarse of 1 evaluates every cell.
+	void configure(double size, double spacing, size_t coarse);
+	void build(const tdoaCost &cost, const enuFrame &frame, const point3 &centre, double level, heatRaster &map) const;
+private:
+	double _size = { 2500 };
+	double _spacing = { 25 };
+	size_t _coarse = { 4 };
+};
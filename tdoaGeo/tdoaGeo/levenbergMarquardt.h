@@ -0,0 +1,139 @@
+#pragma once
+#include <cmath>
+#include <functional>
+#include <valarray>
+#include <limits>
+#include <algorithm>
+
+//Fills in the residuals r at x and the jacobian dr/dx, r.size() x x.size() row major. Returns false if x
+//is outside the region being searched.
+typedef std::function<bool(const std::valarray<double> &x, std::valarray<double> &r, std::valarray<double> &jacobian)> residualFunction;
+
+//Levenberg-Marquardt least squares. Each step solves the normal equations (JtJ + lambda.diag(JtJ)) h = -Jtr,
+//so it is Gauss-Newton near the minimum and steepest descent, with a shorter step, when far from it or the
+//model is poor. Works on the same residuals as the rms error the simplex minimises, but where that needs
+//hundreds of evaluations this needs a handful as the gradient is known.
+class levenbergMarquardt
+{
+public:
+	levenbergMarquardt(residualFunction residuals) : _residuals(residuals) {};
+	~levenbergMarquardt() {};
+
+	//Overwrites start with the result. Returns the rms of the residuals there, or max if start is outside
+	//the search region. Stops once an accepted step improves the rms by less than threshold.
+	double optimise(std::valarray<double> &start, int maxIterations = 50, double threshold = 1e-6)
+	{
+		const size_t n = start.size();
+		std::valarray<double> x = start, r, jacobian;
+		_iterations = 0;
+		_normal.resize(n * n);
+		_normal = 0;
+		if (!_residuals(x, r, jacobian) || r.size() == 0)
+			return std::numeric_limits<double>::max();
+		double cost = (r * r).sum();
+		double lambda = 1e-3;
+		std::valarray<double> g(n), a(n * n), h(n), trial(n), rTrial, jTrial;
+		for (_iterations = 0; _iterations < maxIterations; _iterations++)
+		{
+			normalEquations(jacobian, r, n, _normal, g);
+			bool accepted = false;
+			double previous = cost;
+			while (!accepted && lambda < 1e12)
+			{
+				a = _normal;
+				for (size_t i = 0; i < n; i++)
+					a[i * n + i] += lambda * std::max(_normal[i * n + i], 1e-12);
+				std::valarray<double> b = -g;
+				if (solveLinear(a, b, n, h))
+				{
+					trial = x + h;
+					if (_residuals(trial, rTrial, jTrial))
+					{
+						double trialCost = (rTrial * rTrial).sum();
+						if (trialCost < cost)
+						{
+							x = trial;
+							r = rTrial;
+							jacobian = jTrial;
+							cost = trialCost;
+							lambda = std::max(lambda / 10, 1e-12);
+							accepted = true;
+							continue;
+						}
+					}
+				}
+				lambda *= 10;
+			}
+			if (!accepted || sqrt(previous / r.size()) - sqrt(cost / r.size()) < threshold)
+				break;
+		}
+		//Normal matrix at the answer
+		normalEquations(jacobian, r, n, _normal, g);
+		start = x;
+		return sqrt(cost / r.size());
+	}
+
+	//JtJ at the last answer, n x n row major. Its inverse scaled by the residual variance is the covariance
+	//of the answer.
+	const std::valarray<double> &normal() const { return _normal; };
+	int iterations() const { return _iterations; };
+
+	//Gaussian elimination with partial pivoting, a is destroyed. Returns false if a is singular.
+	static bool solveLinear(std::valarray<double> &a, std::valarray<double> &b, size_t n, std::valarray<double> &x)
+	{
+		for (size_t col = 0; col < n; col++)
+		{
+			size_t pivot = col;
+			for (size_t row = col + 1; row < n; row++)
+			{
+				if (std::abs(a[row * n + col]) > std::abs(a[pivot * n + col]))
+					pivot = row;
+			}
+			if (a[pivot * n + col] == 0 || !std::isfinite(a[pivot * n + col]))
+				return false;
+			if (pivot != col)
+			{
+				for (size_t j = 0; j < n; j++)
+					std::swap(a[col * n + j], a[pivot * n + j]);
+				std::swap(b[col], b[pivot]);
+			}
+			for (size_t row = col + 1; row < n; row++)
+			{
+				double f = a[row * n + col] / a[col * n + col];
+				for (size_t j = col; j < n; j++)
+					a[row * n + j] -= f * a[col * n + j];
+				b[row] -= f * b[col];
+			}
+		}
+		for (size_t i = n; i-- > 0;)
+		{
+			double sum = b[i];
+			for (size_t j = i + 1; j < n; j++)
+				sum -= a[i * n + j] * x[j];
+			x[i] = sum / a[i * n + i];
+		}
+		return true;
+	}
+
+private:
+	static void normalEquations(const std::valarray<double> &jacobian, const std::valarray<double> &r, size_t n,
+								std::valarray<double> &normal, std::valarray<double> &g)
+	{
+		const size_t m = r.size();
+		normal = 0;
+		g = 0;
+		for (size_t k = 0; k < m; k++)
+		{
+			for (size_t i = 0; i < n; i++)
+			{
+				g[i] += jacobian[k * n + i] * r[k];
+				for (size_t j = 0; j < n; j++)
+					normal[i * n + j] += jacobian[k * n + i] * jacobian[k * n + j];
+			}
+		}
+	}
+
+	residualFunction _residuals;
+	std::valarray<double> _normal;
+	int _iterations = { 0 };
+};
@@ -16,7 +16,7 @@ void location::setAltitude(const double alt)
 	setSpherical(_lat, _lon, alt);
 }
 
-void location::getLatLong(std::valarray<double> &coordinates)
+void location::getLatLong(std::valarray<double> &coordinates) const
 {
 	if(coordinates.size() != 2)
 		coordinates.resize(2);
@@ -25,27 +25,27 @@ void location::getLatLong(std::valarray<double> &coordinates)
 	coordinates[1] = _lon;
 }
 
-void location::getLatLong(std::complex<double> &coordinates)
+void location::getLatLong(std::complex<double> &coordinates) const
 {
 	coordinates = std::complex<double>(_lat, _lon);
 }
 
-double location::getLat()
+double location::getLat() const
 {
 	return _lat;
 }
 
-double location::getLon()
+double location::getLon() const
 {
 	return _lon;
 }
 
-double location::getAlt()
+double location::getAlt() const
 {
 	return(_alt);
 }
 
-void location::getSpherical(std::valarray<double> &coordinates)
+void location::getSpherical(std::valarray<double> &coordinates) const
 {
 	if (coordinates.size() != 3)
 		coordinates.resize(3);
@@ -72,7 +72,7 @@ void location::setSpherical(const double lat, const double lon, const double alt
 	latLongAltToRect();
 }
 
-void location::getCartesian(std::valarray<double> &coordinates)
+void location::getCartesian(std::valarray<double> &coordinates) const
 {
 	//Make sure enough room for x,y & z
 	if (coordinates.size() < 3)
@@ -83,6 +83,24 @@ void location::getCartesian(std::valarray<double> &coordinates)
 	coordinates[2] = _z;
 }
 
+void location::getCartesian(double *coordinates) const
+{
+	coordinates[X] = _x;
+	coordinates[Y] = _y;
+	coordinates[Z] = _z;
+}
+
+point3 location::getCartesian() const
+{
+	point3 p = { _x, _y, _z };
+	return p;
+}
+
+void location::setCartesian(const point3 &coordinates)
+{
+	setCartesian(coordinates.x, coordinates.y, coordinates.z);
+}
+
 void location::setCartesian(const std::valarray<double> &coordinates)
 {
 	double x = coordinates[X];
@@ -132,7 +150,7 @@ void location::latLongAltFromRect()
 	_alt = radius - EARTH_RADIUS;
 }
 
-double location::distance(const location &loc2)
+double location::distance(const location &loc2) const
 {
 	return sqrt(pow(_x - loc2._x, 2.0) + pow(_y - loc2._y, 2.0) + pow(_z - loc2._z, 2.0));
 }
@@ -156,7 +174,7 @@ void location::move(double distance, double bearing)
 }
 
 //Great circle distance between two points on the earth
-double location::circleDistance(const location &loc2)
+double location::circleDistance(const location &loc2) const
 {
 	double lat1 = DEG_TO_RAD(_lat);
 	double lon1 = DEG_TO_RAD(_lon);
@@ -170,3 +188,108 @@ double location::circleDistance(const location &loc2)
 	double altitudeDelta = loc2._alt - _alt;
 	return sqrt((distance * distance) + (altitudeDelta * altitudeDelta));
 }
+
+void enuFrame::setOrigin(const location &anchor)
+{
+	double lat = DEG_TO_RAD(anchor.getLat());
+	double lon = DEG_TO_RAD(anchor.getLon());
+	_up[X] = cos(lat) * cos(lon);
+	_up[Y] = cos(lat) * sin(lon);
+	_up[Z] = sin(lat);
+	_east[X] = -sin(lon);
+	_east[Y] = cos(lon);
+	_east[Z] = 0;
+	_north[X] = -sin(lat) * cos(lon);
+	_north[Y] = -sin(lat) * sin(lon);
+	_north[Z] = cos(lat);
+	for (size_t i = 0; i < 3; i++)
+		_origin[i] = EARTH_RADIUS * _up[i];
+}
+
+void enuFrame::toLocal(const location &loc, double *enu) const
+{
+	double xyz[3];
+	loc.getCartesian(xyz);
+	double offset[3] = { xyz[X] - _origin[X], xyz[Y] - _origin[Y], xyz[Z] - _origin[Z] };
+	rotate(offset, enu);
+}
+
+point3 enuFrame::toLocal(const location &loc) const
+{
+	return toLocal(loc.getCartesian());
+}
+
+point3 enuFrame::toLocal(const point3 &earth) const
+{
+	double offset[3] = { earth.x - _origin[X], earth.y - _origin[Y], earth.z - _origin[Z] };
+	double enu[3];
+	rotate(offset, enu);
+	point3 p = { enu[X], enu[Y], enu[Z] };
+	return p;
+}
+
+void enuFrame::rotate(const double *direction, double *enu) const
+{
+	enu[X] = direction[X] * _east[X] + direction[Y] * _east[Y] + direction[Z] * _east[Z];
+	enu[Y] = direction[X] * _north[X] + direction[Y] * _north[Y] + direction[Z] * _north[Z];
+	enu[Z] = direction[X] * _up[X] + direction[Y] * _up[Y] + direction[Z] * _up[Z];
+}
+
+location enuFrame::toLocation(const double *enu, size_t dimensions) const
+{
+	point3 p = { enu[X], enu[Y], dimensions > 2 ? enu[Z] : 0 };
+	location loc;
+	loc.setCartesian(toEarth(p, dimensions < 3));
+	return loc;
+}
+
+location enuFrame::toLocation(const point3 &enu) const
+{
+	location loc;
+	loc.setCartesian(toEarth(enu, false));
+	return loc;
+}
+
+point3 enuFrame::toEarth(const point3 &enu, bool onSurface) const
+{
+	double up = onSurface ? surface(enu.x, enu.y) : enu.z;
+	point3 p = { _origin[X] + enu.x * _east[X] + enu.y * _north[X] + up * _up[X],
+				 _origin[Y] + enu.x * _east[Y] + enu.y * _north[Y] + up * _up[Y],
+				 _origin[Z] + enu.x * _east[Z] + enu.y * _north[Z] + up * _up[Z] };
+	return p;
+}
+
+void enuFrame::horizon(const point3 &enu, point3 &east, point3 &north) const
+{
+	//Up from the centre of the earth, which is straight below the origin
+	double v[3] = { enu.x, enu.y, enu.z + EARTH_RADIUS };
+	double radius = sqrt(v[X] * v[X] + v[Y] * v[Y] + v[Z] * v[Z]);
+	double up[3] = { v[X] / radius, v[Y] / radius, v[Z] / radius };
+	//East is square to the earth's axis and up
+	double axis[3] = { _east[Z], _north[Z], _up[Z] };
+	double e[3] = { axis[Y] * up[Z] - axis[Z] * up[Y], axis[Z] * up[X] - axis[X] * up[Z], axis[X] * up[Y] - axis[Y] * up[X] };
+	double length = sqrt(e[X] * e[X] + e[Y] * e[Y] + e[Z] * e[Z]);
+	east.x = e[X] / length;
+	east.y = e[Y] / length;
+	east.z = e[Z] / length;
+	north.x = up[Y] * east.z - up[Z] * east.y;
+	north.y = up[Z] * east.x - up[X] * east.z;
+	north.z = up[X] * east.y - up[Y] * east.x;
+}
+
+point3 enuFrame::move(const point3 &enu, double distance, double bearing) const
+{
+	point3 east, north;
+	horizon(enu, east, north);
+	double v[3] = { enu.x, enu.y, enu.z + EARTH_RADIUS };
+	double radius = sqrt(v[X] * v[X] + v[Y] * v[Y] + v[Z] * v[Z]);
+	//Turn through distance / EARTH_RADIUS towards the bearing, keeping the distance from the centre of the earth
+	double angle = distance / EARTH_RADIUS;
+	double c = cos(angle), s = sin(angle) * radius;
+	double b = DEG_TO_RAD(bearing);
+	double se = sin(b) * s, sn = cos(b) * s;
+	point3 p = { v[X] * c + east.x * se + north.x * sn,
+				 v[Y] * c + east.y * se + north.y * sn,
+				 v[Z] * c + east.z * se + north.z * sn - EARTH_RADIUS };
+	return p;
+}
@@ -4,6 +4,7 @@
 #include <valarray>
 #include <complex>
 #include <iostream>
+#include <type_traits>
 
 #define PI 3.141592653589793238462643383279502884197169399375105820974944592307816406286
 #define EARTH_RADIUS 6371000
@@ -16,6 +17,16 @@
 enum {LAT=0, LON, ALT};
 enum {X=0, Y, Z};
 
+//A bare position for the arithmetic. Three doubles and nothing else, so it copies as a block and arrays of
+//them vectorise. Whether it is earth centred or in a local frame is up to whoever holds it.
+struct point3
+{
+	double x;
+	double y;
+	double z;
+};
+static_assert(std::is_trivially_copyable<point3>::value && sizeof(point3) == 3 * sizeof(double), "point3 must stay plain data");
+
 class serializable {
 public:
 	virtual void serialize(std::ostream& os) const = 0;
@@ -26,7 +37,7 @@ class location : public serializable
 public:
 	virtual void serialize(std::ostream& os) const 
 	{
-		os << _lat << ", " << _lon << " " << _alt << "m " << _timeDelta << "ns";
+		os << _lat << ", " << _lon << " " << _alt << "m";
 	}
 	location() {};
 	location(double lat, double lon, double alt);
@@ -37,33 +48,68 @@ public:
 	bool operator < (location &l) { return (l._lat + l._lon < _lat + _lon); };
 	void latLongAltToRect();
 	void latLongAltFromRect();
-	void getLatLong(std::valarray<double> &coordinates);
-	void getLatLong(std::complex<double> &coordinates);
-	double getLat();
-	double getLon();
-	double getAlt();
+	void getLatLong(std::valarray<double> &coordinates) const;
+	void getLatLong(std::complex<double> &coordinates) const;
+	double getLat() const;
+	double getLon() const;
+	double getAlt() const;
 	void getxy(std::valarray<double> &coordinates);
-	void getSpherical(std::valarray<double> &coordinates);
-	void getCartesian(std::valarray<double> &coordinates);
+	void getSpherical(std::valarray<double> &coordinates) const;
+	void getCartesian(std::valarray<double> &coordinates) const;
+	void getCartesian(double *coordinates) const;
+	point3 getCartesian() const;
 	void setSpherical(const double lat, const double lon, const double alt);
 	void setCartesian(const double x, const double y, const double z);
 	void setCartesian(const double x, const double y, bool autoUpdate = true);
 	void setSpherical(const std::valarray<double> &coordinates);
 	void setCartesian(const std::valarray<double> &coordinates);
+	void setCartesian(const point3 &coordinates);
 	void setAltitude(double alt);
-	double distance(const location &loc2);
+	double distance(const location &loc2) const;
 	void move(double distance, double bearing);
-	double circleDistance(const location &loc2);
+	double circleDistance(const location &loc2) const;
 	double _error = { 0 };
-	//Delay at this location relative to the master
-	int32_t _timeDelta = { 0 };
-	double _power = { 0 };
-	double _gain = { 640 };
-	uint32_t _port = { 0 };
-	std::string _host;
 private:
-	double _x; double _y; double _z;
-	double _lat; double _lon; double _alt;
-	//struct { bool spherical = { false }; bool cartesian = { false }; } valid;
+	//Both forms are kept up to date by every setter, so the getters only read and a location that isn't
+	//being changed can be read from any thread. The solver works in point3, so this is only paid at the edges.
+	double _x = { EARTH_RADIUS }; double _y = { 0 }; double _z = { 0 };
+	double _lat = { 0 }; double _lon = { 0 }; double _alt = { 0 };
 };
 
+//Local East-North-Up frame in metres with its origin on the surface of the earth at the anchor. Going to
+//and from it is a rotation and shift of the earth centred coordinates, so distances are the same in either
+//but the numbers stay small and a point on the surface is a simple function of east and north.
+class enuFrame
+{
+public:
+	enuFrame() {};
+	~enuFrame() {};
+	void setOrigin(const location &anchor);
+	//Point to east, north and up
+	void toLocal(const location &loc, double *enu) const;
+	point3 toLocal(const location &loc) const;
+	point3 toLocal(const point3 &earth) const;
+	//Earth centred direction to the frame's axes
+	void rotate(const double *direction, double *enu) const;
+	//From two or three coordinates. With two the point is on the surface.
+	location toLocation(const double *enu, size_t dimensions) const;
+	location toLocation(const point3 &enu) const;
+	//Back to earth centred. On the surface up is worked out from east and north and enu.z is ignored.
+	point3 toEarth(const point3 &enu, bool onSurface) const;
+	//Directions of east and north where the point is, in the frame. They turn away from the frame's own
+	//with distance from the origin.
+	void horizon(const point3 &enu, point3 &east, point3 &north) const;
+	//As location::move(), along the great circle at the point's height, without leaving the frame
+	point3 move(const point3 &enu, double distance, double bearing) const;
+	//Up of the surface of the earth at east, north
+	static double surface(double east, double north)
+	{
+		double horizontal = east * east + north * north;
+		return -horizontal / (EARTH_RADIUS + sqrt(std::abs(static_cast<double>(EARTH_RADIUS) * EARTH_RADIUS - horizontal)));
+	};
+private:
+	double _origin[3] = { EARTH_RADIUS, 0, 0 };
+	double _east[3] = { 0, 1, 0 };
+	double _north[3] = { 0, 0, 1 };
+	double _up[3] = { 1, 0, 0 };
+};
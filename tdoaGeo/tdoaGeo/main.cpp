@@ -7,7 +7,7 @@
 
 std::mutex cout_mtx;
 
-SafeQueue<tdoaResult *> results;
+SpscQueue<std::unique_ptr<tdoaResult>> results;
 
 int main(int argc, char *argv[])
 {
@@ -43,16 +43,10 @@ int main(int argc, char *argv[])
 		//results.push(NULL);
 		//Pop a pointer to IQ data from a node.
 		//We will be blocked waiting for data to appear.
-		tdoaResult *result = results.front();
-		windowOpen = plot.plotResult(result);
+		std::unique_ptr<tdoaResult> result = results.take();
+		windowOpen = plot.plotResult(result.get());
 		//windowOpen = plot.drawSignal(result->axes);
-
-		if (result != NULL)
-		{
-			//std::cout << "popping result " << result->target.timeStamp << std::endl;
-			delete result;
-		}
-		results.pop();
+		//std::cout << "popping result " << result->target.timeStamp << std::endl;
 	}
 
 	tdoa.stop();
@@ -6,7 +6,7 @@
 //Test function to generate simulated data packets.
 capture *node::getPacketData(void)
 {
-	capture *r = new capture(_host.c_str(), _port);
+	capture *r = _pool.get(_host, _port);
 	try
 	{
 		_timeGrid += std::chrono::milliseconds(_measureInterval_ms);
@@ -21,11 +21,8 @@ capture *node::getPacketData(void)
 		r->_long = position[LON] * 1e6;
 		r->_deci = 40e6 / _bandwidth_Hz;
 		r->_time = _timeGrid.time_since_epoch().count();
-		int size = 1;
-		while (size < _samples)
-			size *= 2;
-		size /= 2;
-		r->iqData.resize(size);
+		//Longest length the mixed radix FFT handles at full speed
+		r->resize(fft::goodSize(_samples));
 		double metres = _loc.distance(_transmitter);
 		r->_power = 1 / (1 + metres);
 		double flightTime = metres / SPEED_OF_LIGHT;
@@ -33,7 +30,7 @@ capture *node::getPacketData(void)
 		dre.seed(r->_time & 0xffffffff);
 		std::uniform_real_distribution<double> modulation(-1, 1);
 		for (size_t i = 0; i < r->iqData.size(); i++)
-			r->iqData[i] = std::complex<double>(modulation(dre), modulation(dre));
+			r->iqData[i] = TComplex(static_cast<TSample>(modulation(dre)), static_cast<TSample>(modulation(dre)));
 		//implement time shift in frequency domain
 		fft fourier;
 		fourier.transform(r->iqData);
@@ -44,7 +41,7 @@ capture *node::getPacketData(void)
 		double fftBin = bw / r->iqData.size();
 		for (size_t i = 0; i < r->iqData.size(); i++)
 		{
-			r->iqData[i] *= std::polar<double>(1.0, -2 * PI * freq * flightTime);
+			r->iqData[i] *= TComplex(std::polar<double>(1.0, -2 * PI * freq * flightTime));
 			freq += fftBin;
 		}
 		r->iqData = r->iqData.cshift(static_cast<int>(r->iqData.size()) / 2);
@@ -62,7 +59,7 @@ capture *node::getPacketData(void)
 capture *node::getPacketData(T_PACKET* packet)
 {
 
-	capture *r = new capture(_host.c_str(), _port);
+	capture *r = _pool.get(_host, _port);
 	try
 	{
 		if (packet != NULL)
@@ -133,18 +130,17 @@ capture *node::getPacketData(T_PACKET* packet)
 						if (ptype != PARAM_INT && ptype != PARAM_UNSIGNED_INT && ptype != PARAM_STRING)
 						{
 							//std::cout << _host << " returned " << plength << " samples" << std::endl;
-							int size = 1;
-							while (size < plength / 2)
-								size *= 2;
-							size /= 2;
-							r->iqData.resize(size);
+							//Trim to the longest length the mixed radix FFT handles at full speed, so
+							//at most a few percent of the capture is lost rather than up to half
+							int size = static_cast<int>(fft::goodSize(plength / 2));
+							r->resize(size);
 							//std::cout << plength << " samples size: " << size << std::endl;
 							int16_t *iq = static_cast<int16_t *>(pdata);
 							//Copy in last first so we discard any warm up samples
 							power = 0;
 							for (int i = plength - 1, j = size - 1; j >= 0; i -= 2, j--)
 							{
-								r->iqData[j] = std::complex<double>(iq[i - 1], iq[i]);
+								r->iqData[j] = TComplex(iq[i - 1], iq[i]);
 								power += pow(std::abs(r->iqData[j]), 2);
 							}
 							power /= size;
@@ -365,6 +361,8 @@ void node::setParams(Json::Value &config)
 	_measureInterval_ms = config.get("measureInterval_ms", _measureInterval_ms).asInt();
 	_testMode = config.get("testMode", _testMode).asBool();
 	_minSampleRate = config.get("minSampleRate", _minSampleRate).asDouble();
+	if (config.isMember("peakRefinement"))
+		_refinement = fft::refinement(config["peakRefinement"].asString());
 	_loc.setSpherical(config.get("lat", _loc.getLat()).asDouble(), config.get("lon", _loc.getLon()).asDouble(), config.get("alt", _loc.getAlt()).asDouble());
 	if (config.isMember("transmitter"))
 	{
@@ -373,17 +371,29 @@ void node::setParams(Json::Value &config)
 	}
 };
 
-// Given a spectrum, zero pad so that after FFT inversion the signal is resampled by a factor of 2^N
-void node::UpSampleSpectrum(uint32_t interpolation, TSignal &spectrum)
+// Given a spectrum, zero pad so that after FFT inversion the signal is resampled by a factor of 2^N.
+// The padded spectrum is built in the capture's spare buffer and swapped in, so it allocates nothing once
+// both buffers have their working sizes.
+void node::UpSampleSpectrum(uint32_t interpolation, capture *packet)
 {
-	int shift = static_cast<int>(spectrum.size() / 2);
-	TSignal temp = spectrum.cshift(-shift);
-	spectrum.resize(interpolation * spectrum.size());
-	std::copy(begin(temp), end(temp), begin(spectrum));
-	spectrum = spectrum.cshift(shift);
-	spectrum[shift] /= 2.0;
-	spectrum[spectrum.size() - shift] = spectrum[shift];
-	spectrum *= interpolation;
+	TSignal &spectrum = packet->iqData;
+	TSignal &padded = packet->_spare;
+	const size_t N = spectrum.size();
+	const size_t M = interpolation * N;
+	const size_t shift = N / 2;
+	if (padded.size() != M)
+		padded.resize(M);
+	//Same as cshift(-shift), pad to M, cshift(shift): the lower part of the spectrum stays at the start,
+	//the upper part moves to the end and zeros go between.
+	const TComplex *in = &spectrum[0];
+	TComplex *out = &padded[0];
+	std::copy(in, in + N - shift, out);
+	std::fill(out + N - shift, out + M - shift, TComplex(0));
+	std::copy(in + N - shift, in + N, out + M - shift);
+	padded[shift] /= 2;
+	padded[M - shift] = padded[shift];
+	padded *= static_cast<TSample>(interpolation);
+	spectrum.swap(padded);
 }
 
 void node::run()
@@ -415,20 +425,26 @@ void node::run()
 				//resolution so effective sample rate needs to be >10MHz. The resolution of the 
 				//measured correlation peak will affect the best achievable rms error as a
 				//perfect solution is unlikely to be found if the time offsets are even slightly off.
-				double sampleRate = (1e6 * packet->_srtt) / packet->_deci;
-				uint32_t interpolation = 1;
-				while (sampleRate < _minSampleRate)
+				//Not needed when the correlation peak is refined instead.
+				if (_refinement == REFINE_NONE)
 				{
-					interpolation *= 2;
-					sampleRate *= 2;
+					double sampleRate = (1e6 * packet->_srtt) / packet->_deci;
+					uint32_t interpolation = 1;
+					while (sampleRate < _minSampleRate)
+					{
+						interpolation *= 2;
+						sampleRate *= 2;
+					}
+					UpSampleSpectrum(interpolation, packet);
+					packet->_srtt *= interpolation;
 				}
-				UpSampleSpectrum(interpolation, packet->iqData);
-				packet->_srtt *= interpolation;
 				_result->push(packet);
 
 				//std::lock_guard<std::mutex> lk(cout_mtx);
 				//std::cout << _host << ":" << _port << " pushed " << packet->_time << " power: " << packet->power << std::endl;
 			}
+			else
+				packet->release();
 		}
 	}
 	catch (std::exception e)
@@ -16,7 +16,7 @@
 #include <random>
 #include <numeric>
 #include <atomic>
-#include "safeQueue.h"
+#include "ringQueue.h"
 #include "json.h"
 #include "fft.h"
 #include "location.h"
@@ -24,11 +24,12 @@
 
 extern std::mutex cout_mtx;
 
-typedef std::valarray<std::complex<double>> TSignal;
 //typedef struct { double x; double y; double z; } location;	//location is x, y, z
 
 
 
+class capturePool;
+
 class capture
 {
 public:
@@ -41,7 +42,37 @@ public:
 	{
 	}
 	bool operator < (capture &c) { return _power < c._power; };
+	//Back to default values for reuse, keeping the spectrum buffers
+	void reset(const std::string &host, const uint32_t port)
+	{
+		_host = host;
+		_port = port;
+		_power = 0;
+		_srtt = 40;
+		_deci = 0;
+		_gfix = 0;
+		_alti = 0;
+		_lati = 0;
+		_long = 0;
+		_time = 0;
+		_gain = 640;
+		_index = 0;
+	};
+	//Make iqData n samples long. The spare buffer is swapped in first, so a capture that alternates between
+	//two lengths, as one that is upsampled does, stops allocating once both buffers have been sized.
+	void resize(size_t n)
+	{
+		if (iqData.size() == n)
+			return;
+		iqData.swap(_spare);
+		if (iqData.size() != n)
+			iqData.resize(n);
+	};
+	//Give the capture back to the pool it came from, or delete it if it didn't come from one
+	void release();
 	TSignal iqData;
+	TSignal _spare;
+	capturePool *_pool = { NULL };
 	double _power = { 0 };
 	int32_t _srtt = { 40 };		//Only returned by Nexus so default to 40MHz for axis/marvell
 	int32_t _deci = { 0 };
@@ -56,12 +87,61 @@ public:
 	uint32_t _port = { 0 };
 };
 
+//Recycles the captures of one node, so once the pipeline has filled no capture or spectrum buffer is
+//allocated. Only the node thread takes captures out, but any thread may give them back.
+class capturePool
+{
+public:
+	explicit capturePool(size_t size = 64) : _free(size) {};
+	~capturePool()
+	{
+		capture *c;
+		while (_free.tryFront(c))
+		{
+			_free.pop();
+			delete c;
+		}
+	};
+	capture *get(const std::string &host, const uint32_t port)
+	{
+		capture *c;
+		if (_free.tryFront(c))
+		{
+			_free.pop();
+			c->reset(host, port);
+			return c;
+		}
+		c = new capture(host.c_str(), port);
+		c->_pool = this;
+		_allocated++;
+		return c;
+	};
+	void put(capture *c)
+	{
+		if (!_free.tryPush(c))
+			delete c;
+	};
+	//Number of captures made rather than reused
+	size_t allocated() const { return _allocated; };
+private:
+	MpscQueue<capture *> _free;
+	size_t _allocated = { 0 };
+};
+
+inline void capture::release()
+{
+	if (_pool != NULL)
+		_pool->put(this);
+	else
+		delete this;
+}
+
 
 class node
 {
 public:
 	node() {};
-	node(SafeQueue<capture *> *q) { _result = q; };
+	node(MpscQueue<capture *> *q) { _result = q; };
 	virtual ~node() {};
 
 	void setParams(Json::Value &config);
@@ -70,6 +150,7 @@ public:
 	void stop() { _terminate = true; };
 	std::string _host;
 	uint32_t _port = { 9999 };
+	const location &position() const { return _loc; };	//as configured
 protected:
 	void ackWait();
 	std::vector<node *> *_nodes;
@@ -81,7 +162,7 @@ protected:
 	void disconnect();
 	void receive_packet();
 	void send_packet(T_PACKET *packet);
-	void UpSampleSpectrum(uint32_t interpolation, TSignal &spectrum);
+	void UpSampleSpectrum(uint32_t interpolation, capture *packet);
 	T_PACKET* get_rx_packet();
 	std::atomic_bool  _terminate = { false };
 	std::mutex _mtx;
@@ -90,11 +171,13 @@ protected:
 	uint64_t _bandwidth_Hz;
 	uint32_t _samples = { 1024 };
 	double _minSampleRate = { 10e6 };
+	peakRefinement _refinement = { REFINE_NONE };	//anything but REFINE_NONE skips the upsampling
 	bool _nexusNode = { false };
 	//uint64_t _startTime = { 0 };
 	uint32_t _field_id = { 0 };
 	fft _fourier;
-	SafeQueue<capture *> *_result;
+	capturePool _pool;
+	MpscQueue<capture *> *_result;
 	T_NCP_CLIENT_CONNECTION* _ncp_client = { NULL };
 
 	//The following are applicable to test mode only
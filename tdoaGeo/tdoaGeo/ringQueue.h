@@ -0,0 +1,303 @@
+#ifndef RING_QUEUE
+#define RING_QUEUE
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+//Bounded lock-free queue for any number of producers and a single consumer. Each slot carries a sequence
+//number which says whose turn it is, so a producer claims a slot with one compare-exchange on the tail and
+//publishes it with one store; the consumer needs no atomic read-modify-write at all. With SingleProducer
+//set the claim is a plain store too, for queues only ever fed from one thread at a time.
+//Drop-in for SafeQueue: front() waits for data and pop() removes it. push() waits for space when full.
+//take() does both, moving the entry out, so T may be a type that can only be moved such as a unique_ptr.
+//Waiting only takes a lock once the fast path has failed, and the other side only notifies if someone is
+//actually waiting.
+template <class T, bool SingleProducer = false>
+class RingQueue
+{
+public:
+  struct statistics
+  {
+    uint64_t full;       //pushes that found the ring full
+    uint64_t empty;      //waits by the consumer for data
+  };
+
+  explicit RingQueue(size_t capacity = 1024)
+  {
+    //Round up to a power of two so the index is a mask
+    _capacity = 2;
+    while (_capacity < capacity)
+      _capacity *= 2;
+    _mask = _capacity - 1;
+    _cells.reset(new cell[_capacity]);
+    for (size_t i = 0; i < _capacity; i++)
+      _cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  ~RingQueue(void)
+  {}
+
+  //Returns false if the ring is full, when anything moved in to t is lost
+  bool tryPush(T t)
+  {
+    return place(t);
+  }
+
+  void push(T t)
+  {
+    if (place(t))
+      return;
+    _full.fetch_add(1, std::memory_order_relaxed);
+    //Back off briefly before sleeping, the consumer is usually about to make room
+    for (int i = 0; i < 64; i++)
+    {
+      std::this_thread::yield();
+      if (place(t))
+        return;
+    }
+    std::unique_lock<std::mutex> lock(_fullMtx);
+    _producersWaiting.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!place(t))
+      _notFull.wait(lock);
+    _producersWaiting.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  //Consumer only. Returns false if the ring is empty
+  bool tryFront(T &t)
+  {
+    cell &c = _cells[_head & _mask];
+    if (c.seq.load(std::memory_order_acquire) != _head + 1)
+      return false;
+    t = c.value;
+    return true;
+  }
+
+  //Consumer only. Returns false if the ring is empty, otherwise moves the entry out and removes it
+  bool tryTake(T &t)
+  {
+    cell &c = _cells[_head & _mask];
+    if (c.seq.load(std::memory_order_acquire) != _head + 1)
+      return false;
+    t = std::move(c.value);
+    pop();
+    return true;
+  }
+
+  //Consumer only. Waits for data, then as tryTake()
+  T take(void)
+  {
+    T val;
+    if (tryTake(val))
+      return val;
+    _empty.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < 64; i++)
+    {
+      std::this_thread::yield();
+      if (tryTake(val))
+        return val;
+    }
+    std::unique_lock<std::mutex> lock(_emptyMtx);
+    _consumerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!tryTake(val))
+      _notEmpty.wait(lock);
+    _consumerWaiting.store(0, std::memory_order_relaxed);
+    return val;
+  }
+
+  //Consumer only. Waits for data
+  T front(void)
+  {
+    T val;
+    if (tryFront(val))
+      return val;
+    _empty.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < 64; i++)
+    {
+      std::this_thread::yield();
+      if (tryFront(val))
+        return val;
+    }
+    std::unique_lock<std::mutex> lock(_emptyMtx);
+    _consumerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!tryFront(val))
+      _notEmpty.wait(lock);
+    _consumerWaiting.store(0, std::memory_order_relaxed);
+    return val;
+  }
+
+  //Consumer only. Waits up to the timeout for data, returns false if none came
+  bool front(T &val, std::chrono::milliseconds timeout)
+  {
+    if (tryFront(val))
+      return true;
+    _empty.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(_emptyMtx);
+    _consumerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool arrived = _notEmpty.wait_for(lock, timeout, [this, &val] { return tryFront(val); });
+    _consumerWaiting.store(0, std::memory_order_relaxed);
+    return arrived;
+  }
+
+  //Consumer only. Removes the entry returned by front()
+  void pop(void)
+  {
+    cell &c = _cells[_head & _mask];
+    c.value = T();
+    c.seq.store(_head + _capacity, std::memory_order_release);
+    _head++;
+    _size.store(_head, std::memory_order_relaxed);
+    wake(_producersWaiting, _fullMtx, _notFull, 1);
+  }
+
+  //Consumer only. Takes up to max entries, waiting for at least one if wait is set. Returns the count.
+  size_t popBatch(T *out, size_t max, bool wait = true)
+  {
+    size_t count = 0;
+    if (max == 0)
+      return 0;
+    if (wait)
+      out[count++] = front();
+    while (count < max)
+    {
+      cell &c = _cells[(_head + count) & _mask];
+      if (c.seq.load(std::memory_order_acquire) != _head + count + 1)
+        break;
+      out[count++] = std::move(c.value);
+    }
+    //Hand the slots back in one go
+    for (size_t i = 0; i < count; i++)
+    {
+      cell &c = _cells[(_head + i) & _mask];
+      c.value = T();
+      c.seq.store(_head + i + _capacity, std::memory_order_release);
+    }
+    _head += count;
+    _size.store(_head, std::memory_order_relaxed);
+    if (count > 0)
+      wake(_producersWaiting, _fullMtx, _notFull, count);
+    return count;
+  }
+
+  //Consumer only. As above but gives up and returns 0 if nothing arrives within the timeout
+  size_t popBatch(T *out, size_t max, std::chrono::milliseconds timeout)
+  {
+    T val;
+    if (max == 0 || !front(val, timeout))
+      return 0;
+    return popBatch(out, max, true);
+  }
+
+  //Approximate when called from a producer
+  size_t size(void)
+  {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _size.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  size_t capacity(void) const
+  {
+    return _capacity;
+  }
+
+  //Consumer only
+  void clear(void)
+  {
+    T val;
+    while (tryFront(val))
+      pop();
+  }
+
+  statistics stats(void) const
+  {
+    statistics s;
+    s.full = _full.load(std::memory_order_relaxed);
+    s.empty = _empty.load(std::memory_order_relaxed);
+    return s;
+  }
+
+private:
+  //Moves t in if there is room, otherwise leaves it alone and returns false, so it can be tried again
+  bool place(T &t)
+  {
+    cell *c;
+    size_t pos = _tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+      c = &_cells[pos & _mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0)
+      {
+        if (SingleProducer)
+        {
+          _tail.store(pos + 1, std::memory_order_relaxed);
+          break;
+        }
+        if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+        return false;
+      else
+        pos = _tail.load(std::memory_order_relaxed);
+    }
+    c->value = std::move(t);
+    c->seq.store(pos + 1, std::memory_order_release);
+    wake(_consumerWaiting, _emptyMtx, _notEmpty, 1);
+    return true;
+  }
+
+  struct cell
+  {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  //Called after publishing. The fence pairs with the one taken before waiting so either the waiter sees
+  //the change or we see the waiter. Each side has its own mutex as a producer waiting for space wakes the
+  //consumer from inside its wait loop. Only as many are woken as there are free slots, so a crowd of
+  //producers doesn't all wake to fight over one.
+  void wake(std::atomic<int> &waiting, std::mutex &mtx, std::condition_variable &cv, size_t slots)
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int sleepers = waiting.load(std::memory_order_relaxed);
+    if (sleepers != 0)
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      for (size_t i = 0; i < slots && i < static_cast<size_t>(sleepers); i++)
+        cv.notify_one();
+    }
+  }
+
+  std::unique_ptr<cell[]> _cells;
+  size_t _capacity;
+  size_t _mask;
+  alignas(64) std::atomic<size_t> _tail = { 0 };        //next slot to claim, shared by producers
+  alignas(64) size_t _head = { 0 };                     //next slot to read, consumer only
+  std::atomic<size_t> _size = { 0 };                    //copy of _head for size()
+  alignas(64) std::atomic<int> _consumerWaiting = { 0 };
+  std::atomic<int> _producersWaiting = { 0 };
+  std::atomic<uint64_t> _full = { 0 };
+  std::atomic<uint64_t> _empty = { 0 };
+  std::mutex _emptyMtx;
+  std::condition_variable _notEmpty;
+  std::mutex _fullMtx;
+  std::condition_variable _notFull;
+};
+
+//Capture path, fed by every node thread
+template <class T> using MpscQueue = RingQueue<T, false>;
+//Result path, fed by one thread at a time
+template <class T> using SpscQueue = RingQueue<T, true>;
+#endif
@@ -0,0 +1,180 @@
+#pragma once
+#include "fft.h"
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+//Small vectors of interleaved TComplex used by the FFT butterflies. Each type holds width complex
+//values and provides the handful of operations the radix-4 passes need, so the passes are written
+//once as templates and instantiated for the widest set the build targets. Select with /arch:AVX2
+//(MSVC) or -mavx2 / -mavx512f (gcc). cvecScalar is the portable fallback. With SINGLE_PRECISION
+//defined the vector types hold complex<float>, doubling the number of samples per register.
+
+struct cvecScalar
+{
+	static const size_t width = 1;
+	TSample re, im;
+	static cvecScalar load(const TComplex *p) { cvecScalar r; r.re = p->real(); r.im = p->imag(); return r; }
+	void store(TComplex *p) const { *p = TComplex(re, im); }
+	static cvecScalar make(TSample r, TSample i) { cvecScalar v; v.re = r; v.im = i; return v; }
+	friend cvecScalar operator + (const cvecScalar &a, const cvecScalar &b) { return make(a.re + b.re, a.im + b.im); }
+	friend cvecScalar operator - (const cvecScalar &a, const cvecScalar &b) { return make(a.re - b.re, a.im - b.im); }
+	//a * b
+	static cvecScalar mul(const cvecScalar &a, const cvecScalar &b) { return make(a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re); }
+	//a * conj(b)
+	static cvecScalar mulConj(const cvecScalar &a, const cvecScalar &b) { return make(a.re * b.re + a.im * b.im, a.im * b.re - a.re * b.im); }
+	static cvecScalar scale(const cvecScalar &a, TSample s) { return make(a.re * s, a.im * s); }
+	//a * -j for the forward transform, a * +j for the inverse
+	template <bool inverse> static cvecScalar rotate(const cvecScalar &a) { return inverse ? make(-a.im, a.re) : make(a.im, -a.re); }
+	TSample norm() const { return re * re + im * im; }
+};
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#ifndef SINGLE_PRECISION
+struct cvecAvx2
+{
+	static const size_t width = 2;
+	__m256d v;
+	static cvecAvx2 wrap(__m256d x) { cvecAvx2 r; r.v = x; return r; }
+	static cvecAvx2 load(const TComplex *p) { return wrap(_mm256_loadu_pd(reinterpret_cast<const double *>(p))); }
+	void store(TComplex *p) const { _mm256_storeu_pd(reinterpret_cast<double *>(p), v); }
+	friend cvecAvx2 operator + (const cvecAvx2 &a, const cvecAvx2 &b) { return wrap(_mm256_add_pd(a.v, b.v)); }
+	friend cvecAvx2 operator - (const cvecAvx2 &a, const cvecAvx2 &b) { return wrap(_mm256_sub_pd(a.v, b.v)); }
+	static cvecAvx2 mul(const cvecAvx2 &a, const cvecAvx2 &b)
+	{
+		__m256d bre = _mm256_movedup_pd(b.v);
+		__m256d bim = _mm256_permute_pd(b.v, 0xF);
+		__m256d asw = _mm256_permute_pd(a.v, 0x5);
+		return wrap(_mm256_addsub_pd(_mm256_mul_pd(a.v, bre), _mm256_mul_pd(asw, bim)));
+	}
+	static cvecAvx2 mulConj(const cvecAvx2 &a, const cvecAvx2 &b)
+	{
+		__m256d bre = _mm256_movedup_pd(b.v);
+		__m256d bim = _mm256_permute_pd(b.v, 0xF);
+		__m256d asw = _mm256_permute_pd(a.v, 0x5);
+		return wrap(_mm256_add_pd(_mm256_mul_pd(a.v, bre), _mm256_xor_pd(_mm256_mul_pd(asw, bim), _mm256_set_pd(-0.0, 0.0, -0.0, 0.0))));
+	}
+	static cvecAvx2 scale(const cvecAvx2 &a, TSample s) { return wrap(_mm256_mul_pd(a.v, _mm256_set1_pd(s))); }
+	template <bool inverse> static cvecAvx2 rotate(const cvecAvx2 &a)
+	{
+		__m256d sw = _mm256_permute_pd(a.v, 0x5);
+		return wrap(inverse ? _mm256_xor_pd(sw, _mm256_set_pd(0.0, -0.0, 0.0, -0.0))
+			                : _mm256_xor_pd(sw, _mm256_set_pd(-0.0, 0.0, -0.0, 0.0)));
+	}
+};
+#else
+struct cvecAvx2
+{
+	static const size_t width = 4;
+	__m256 v;
+	static cvecAvx2 wrap(__m256 x) { cvecAvx2 r; r.v = x; return r; }
+	static __m256 imagSign() { return _mm256_set_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f); }
+	static __m256 realSign() { return _mm256_set_ps(0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f); }
+	static cvecAvx2 load(const TComplex *p) { return wrap(_mm256_loadu_ps(reinterpret_cast<const float *>(p))); }
+	void store(TComplex *p) const { _mm256_storeu_ps(reinterpret_cast<float *>(p), v); }
+	friend cvecAvx2 operator + (const cvecAvx2 &a, const cvecAvx2 &b) { return wrap(_mm256_add_ps(a.v, b.v)); }
+	friend cvecAvx2 operator - (const cvecAvx2 &a, const cvecAvx2 &b) { return wrap(_mm256_sub_ps(a.v, b.v)); }
+	static cvecAvx2 mul(const cvecAvx2 &a, const cvecAvx2 &b)
+	{
+		__m256 bre = _mm256_moveldup_ps(b.v);
+		__m256 bim = _mm256_movehdup_ps(b.v);
+		__m256 asw = _mm256_permute_ps(a.v, 0xB1);
+		return wrap(_mm256_addsub_ps(_mm256_mul_ps(a.v, bre), _mm256_mul_ps(asw, bim)));
+	}
+	static cvecAvx2 mulConj(const cvecAvx2 &a, const cvecAvx2 &b)
+	{
+		__m256 bre = _mm256_moveldup_ps(b.v);
+		__m256 bim = _mm256_movehdup_ps(b.v);
+		__m256 asw = _mm256_permute_ps(a.v, 0xB1);
+		return wrap(_mm256_add_ps(_mm256_mul_ps(a.v, bre), _mm256_xor_ps(_mm256_mul_ps(asw, bim), imagSign())));
+	}
+	static cvecAvx2 scale(const cvecAvx2 &a, TSample s) { return wrap(_mm256_mul_ps(a.v, _mm256_set1_ps(s))); }
+	template <bool inverse> static cvecAvx2 rotate(const cvecAvx2 &a)
+	{
+		__m256 sw = _mm256_permute_ps(a.v, 0xB1);
+		return wrap(_mm256_xor_ps(sw, inverse ? realSign() : imagSign()));
+	}
+};
+#endif
+#endif
+
+#if defined(__AVX512F__)
+#ifndef SINGLE_PRECISION
+struct cvecAvx512
+{
+	static const size_t width = 4;
+	__m512d v;
+	static cvecAvx512 wrap(__m512d x) { cvecAvx512 r; r.v = x; return r; }
+	static __m512d flip(__m512d x, __m512i mask) { return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(x), mask)); }
+	static __m512i imagSign() { return _mm512_castpd_si512(_mm512_set_pd(-0.0, 0.0, -0.0, 0.0, -0.0, 0.0, -0.0, 0.0)); }
+	static __m512i realSign() { return _mm512_castpd_si512(_mm512_set_pd(0.0, -0.0, 0.0, -0.0, 0.0, -0.0, 0.0, -0.0)); }
+	static cvecAvx512 load(const TComplex *p) { return wrap(_mm512_loadu_pd(reinterpret_cast<const double *>(p))); }
+	void store(TComplex *p) const { _mm512_storeu_pd(reinterpret_cast<double *>(p), v); }
+	friend cvecAvx512 operator + (const cvecAvx512 &a, const cvecAvx512 &b) { return wrap(_mm512_add_pd(a.v, b.v)); }
+	friend cvecAvx512 operator - (const cvecAvx512 &a, const cvecAvx512 &b) { return wrap(_mm512_sub_pd(a.v, b.v)); }
+	static cvecAvx512 mul(const cvecAvx512 &a, const cvecAvx512 &b)
+	{
+		__m512d bre = _mm512_movedup_pd(b.v);
+		__m512d bim = _mm512_permute_pd(b.v, 0xFF);
+		__m512d asw = _mm512_permute_pd(a.v, 0x55);
+		return wrap(_mm512_fmaddsub_pd(a.v, bre, _mm512_mul_pd(asw, bim)));
+	}
+	static cvecAvx512 mulConj(const cvecAvx512 &a, const cvecAvx512 &b)
+	{
+		__m512d bre = _mm512_movedup_pd(b.v);
+		__m512d bim = _mm512_permute_pd(b.v, 0xFF);
+		__m512d asw = _mm512_permute_pd(a.v, 0x55);
+		return wrap(_mm512_fmadd_pd(a.v, bre, flip(_mm512_mul_pd(asw, bim), imagSign())));
+	}
+	static cvecAvx512 scale(const cvecAvx512 &a, TSample s) { return wrap(_mm512_mul_pd(a.v, _mm512_set1_pd(s))); }
+	template <bool inverse> static cvecAvx512 rotate(const cvecAvx512 &a)
+	{
+		__m512d sw = _mm512_permute_pd(a.v, 0x55);
+		return wrap(flip(sw, inverse ? realSign() : imagSign()));
+	}
+};
+#else
+struct cvecAvx512
+{
+	static const size_t width = 8;
+	__m512 v;
+	static cvecAvx512 wrap(__m512 x) { cvecAvx512 r; r.v = x; return r; }
+	static __m512 flip(__m512 x, __m512i mask) { return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x), mask)); }
+	static __m512i imagSign() { return _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ULL)); }
+	static __m512i realSign() { return _mm512_set1_epi64(0x0000000080000000LL); }
+	static cvecAvx512 load(const TComplex *p) { return wrap(_mm512_loadu_ps(reinterpret_cast<const float *>(p))); }
+	void store(TComplex *p) const { _mm512_storeu_ps(reinterpret_cast<float *>(p), v); }
+	friend cvecAvx512 operator + (const cvecAvx512 &a, const cvecAvx512 &b) { return wrap(_mm512_add_ps(a.v, b.v)); }
+	friend cvecAvx512 operator - (const cvecAvx512 &a, const cvecAvx512 &b) { return wrap(_mm512_sub_ps(a.v, b.v)); }
+	static cvecAvx512 mul(const cvecAvx512 &a, const cvecAvx512 &b)
+	{
+		__m512 bre = _mm512_moveldup_ps(b.v);
+		__m512 bim = _mm512_movehdup_ps(b.v);
+		__m512 asw = _mm512_permute_ps(a.v, 0xB1);
+		return wrap(_mm512_fmaddsub_ps(a.v, bre, _mm512_mul_ps(asw, bim)));
+	}
+	static cvecAvx512 mulConj(const cvecAvx512 &a, const cvecAvx512 &b)
+	{
+		__m512 bre = _mm512_moveldup_ps(b.v);
+		__m512 bim = _mm512_movehdup_ps(b.v);
+		__m512 asw = _mm512_permute_ps(a.v, 0xB1);
+		return wrap(_mm512_fmadd_ps(a.v, bre, flip(_mm512_mul_ps(asw, bim), imagSign())));
+	}
+	static cvecAvx512 scale(const cvecAvx512 &a, TSample s) { return wrap(_mm512_mul_ps(a.v, _mm512_set1_ps(s))); }
+	template <bool inverse> static cvecAvx512 rotate(const cvecAvx512 &a)
+	{
+		__m512 sw = _mm512_permute_ps(a.v, 0xB1);
+		return wrap(flip(sw, inverse ? realSign() : imagSign()));
+	}
+};
+#endif
+#endif
+
+//Widest complex vector the build supports, used wherever a pass has enough contiguous butterflies
+#if defined(__AVX512F__)
+typedef cvecAvx512 cvecWide;
+#elif defined(__AVX2__)
+typedef cvecAvx2 cvecWide;
+#else
+typedef cvecScalar cvecWide;
+#endif
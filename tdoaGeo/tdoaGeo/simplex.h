@@ -1,223 +1,195 @@
 #pragma once
 #include <cmath>
-#include <functional>
 #include <vector>
-#include <memory>
+#include <array>
 #include <algorithm>
-#include <valarray>
 #include <iostream>
-#include <fstream>
 #include <random>
+#include <cstdint>
+#include <type_traits>
+#include <atomic>
 
+	//A batch of points in structure of arrays form, coordinate d of point k in coord[d][k]
+	struct pointBatch
+	{
+		void resize(size_t dimensions, size_t points)
+		{
+			coord.resize(dimensions);
+			for (auto &c : coord)
+				c.resize(points);
+			count = points;
+		}
+		std::vector<std::vector<double>> coord;
+		size_t count = { 0 };
+	};
+
+	//Stands in for the batch objective when there isn't one
+	struct noBatch
+	{
+		void operator()(const pointBatch &, double *) const {}
+	};
 
+	//Nelder-Mead in N dimensions. The vertices are held in place, so a search allocates nothing beyond the
+	//batch buffer which is sized once. objective(const std::array<double, N> &) returns the value to minimise
+	//and is called directly rather than through std::function. If given, batch(const pointBatch &, double *)
+	//evaluates several points at once and is used where the vertices don't depend on each other: the starting
+	//simplex and shrinks. The random spread of the starting simplex comes from a fixed seed, so a search is
+	//repeatable. The object can be reused; each optimise() starts afresh and reset() restarts the sequence.
+	//Make one with makeSimplex<N>().
+	//optimise() gives up early, with the best so far, if stop is given and becomes set.
+	template <size_t N, class Objective, class Batch = noBatch>
 	class simplex
 	{
-	std::default_random_engine _dre;
-	#define BEST (*(*_simplex.begin()))
-	#define WORST (*(*_simplex.rbegin()))
-	#define LOUSY (*(*(_simplex.rbegin()+1)))
-	#define MID(v1,v2) (v1+v2)/2
-	#define F(v1) (*(v1)->y)
-	#define ALPHA 1.0
-	#define BETA 0.5
-	#define GAMMA 1.0
-	#define DELTA 0.5
 	public:
-		simplex() 
-		{
-		};
-		simplex(std::function<double(std::valarray<double>)> callback)
+		typedef std::array<double, N> point;
+
+		simplex(Objective objective, Batch batch = Batch(), uint32_t seed = 1) : _objective(objective), _batch(batch)
 		{
-			_callback = callback;
-			auto seed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-			_dre.seed(seed & 0xffffffff);
+			reset(seed);
+			if (hasBatch)
+				_points.resize(N, N + 1);
 		}
 		~simplex() {};
+
+		void reset(uint32_t seed = 1)
+		{
+			_dre.seed(seed);
+		}
+
 		void print()
 		{
 			std::cout << std::endl << "++++++++++++++++++++++++++++++++" << std::endl;
-			for (size_t i = 0; i < _simplex.size(); i++)
+			for (auto &v : _simplex)
 			{
-				_simplex[i]->print();
+				for (size_t i = 0; i < N; i++)
+					std::cout << v.x[i] << " ";
+				std::cout << "    " << v.y << std::endl;
 			}
 			std::cout << std::endl << "--------------------------------" << std::endl;
 		}
 
-		double optimise(std::valarray<double> &start, double spread, double threshold = 1e-6)
+		double optimise(point &start, double spread, double threshold = 1e-6, const std::atomic<bool> *stop = NULL)
 		{
+			const double alpha = 1.0, beta = 0.5, gamma = 1.0, delta = 0.5;
 			std::uniform_real_distribution<double> dist(-spread, spread);
 			//Create simplex with n+1 vertices
-			for (uint16_t i = 0; i < start.size() + 1; i++)
+			for (auto &v : _simplex)
 			{
-				vertex *v = new vertex(_callback);
-				v->x = start;
-				for (size_t i = 0; i < v->x.size(); i++)
-				{
-					v->x[i] += dist(_dre);
-				}
-				v->evaluate();
-				_simplex.push_back(v);
+				for (size_t i = 0; i < N; i++)
+					v.x[i] = start[i] + dist(_dre);
 			}
-			//print();
-			int i = 0;
-			for (i = 0; i < 1000;i++)
+			evaluateAll();
+			vertex &best = _simplex.front();
+			vertex &worst = _simplex.back();
+			vertex &lousy = _simplex[N - 1];
+			vertex centroid, reflected, expanded, contracted;
+			for (_iterations = 0; _iterations < 1000; _iterations++)
 			{
-				std::sort(_simplex.begin(), _simplex.end(), [](vertex *a, vertex *b) -> bool { return (a->y < b->y); });
-				//std::cout << "------------------------------------------------------------- iteration " << i << std::endl;
-				//print();
-				//Find centroid
-				vertex centroid = BEST;
-				for (size_t i = 1; i < _simplex.size() - 1; i++)
-					centroid += *_simplex[i];
-				centroid /= (_simplex.size() - 1);
-				centroid.evaluate();
-				//centroid.print("centroid = ");
+				std::sort(_simplex.begin(), _simplex.end(), [](const vertex &a, const vertex &b) { return a.y < b.y; });
+				//Find centroid of all but the worst
+				centroid.x = best.x;
+				for (size_t v = 1; v < N; v++)
+				{
+					for (size_t i = 0; i < N; i++)
+						centroid.x[i] += _simplex[v].x[i];
+				}
+				for (size_t i = 0; i < N; i++)
+					centroid.x[i] /= N;
 				//Test for covergence
-				if (converged(threshold))
+				if (worst.y - best.y < threshold)
+					break;
+				if (stop != NULL && stop->load(std::memory_order_relaxed))
 					break;
 				//Reflect
-				vertex reflected = centroid + ((centroid - WORST) * ALPHA);
-				reflected.evaluate();
-				//print("reflected =");
-
-				if (reflected < BEST)
+				along(reflected, centroid, worst, -alpha);
+				if (reflected.y < best.y)
 				{
-					vertex expanded = reflected + ((reflected - centroid) * GAMMA);
-					expanded.evaluate();
-					if (expanded < BEST)
-					{
-						WORST = expanded;
-						//std::cout << "WORST = expanded (97)" << std::endl;
-					}
-					else
-					{
-						WORST = reflected;
-						//std::cout << "WORST = reflected (102)" << std::endl;
-					}
+					along(expanded, reflected, centroid, -gamma);
+					worst = expanded.y < best.y ? expanded : reflected;
 				}
-				else if (reflected <= LOUSY)
+				else if (reflected.y <= lousy.y)
 				{
-					WORST = reflected;
-					//std::cout << "WORST = reflected (108)" << std::endl;
+					worst = reflected;
 				}
 				else
 				{
-					if (reflected > WORST)
+					bool inside = reflected.y > worst.y;
+					//Inside contraction towards the worst, outside towards the reflection
+					along(contracted, centroid, worst, inside ? beta : -beta);
+					if (inside ? contracted.y < worst.y : contracted.y < reflected.y)
 					{
-						//Inside contraction
-						vertex contracted = centroid - ((centroid - WORST) * BETA);
-						contracted.evaluate();
-						//contracted.print("contracted =");
-						if (contracted < WORST)
-						{
-							WORST = contracted;
-							//std::cout << "WORST = contracted (121)" << std::endl;
-						}
-						else
-						{
-							//Shrink
-							//TODO multithread evaluation
-							for (auto it = _simplex.begin(); it != _simplex.end(); it++)
-							{
-								**it = BEST + ((**it - BEST) * DELTA);
-								(*it)->evaluate();
-							}
-							//std::cout << "shrink (131)" << std::endl;
-						}
+						worst = contracted;
 					}
 					else
 					{
-						//Outside contraction
-						vertex contracted = centroid + ((centroid - WORST) * BETA);
-						contracted.evaluate();
-						if (contracted < reflected)
-						{
-							WORST = contracted;
-							//std::cout << "WORST = contracted (142)" << std::endl;
-						}
-						else
+						//Shrink towards the best
+						for (auto &v : _simplex)
 						{
-							//Shrink
-							//TODO multithread evaluation
-							for (auto it = _simplex.begin(); it != _simplex.end(); it++)
-							{
-								**it = BEST + ((**it - BEST) * DELTA);
-								(*it)->evaluate();
-							}
-							//std::cout << "shrink (152)" << std::endl;
+							for (size_t i = 0; i < N; i++)
+								v.x[i] = best.x[i] + (v.x[i] - best.x[i]) * delta;
 						}
+						evaluateAll();
 					}
 				}
 			}
-			//print();
-			//std::cout << "iterations " << i << std::endl;
-			start = BEST.x;
-			return BEST.y;
+			start = best.x;
+			return best.y;
 		}
 
+		int iterations() const { return _iterations; };
+
 	private:
+		struct vertex
+		{
+			point x;
+			double y;
+		};
+		static const bool hasBatch = !std::is_same<Batch, noBatch>::value;
 
-		class vertex
+		//v = from + (to - from) * scale, evaluated
+		void along(vertex &v, const vertex &from, const vertex &to, double scale)
 		{
-		public:
-			vertex() {};
-			vertex(std::function<double(std::valarray<double>)> callback)
-			{
-				_callback = callback;
-			}
+			for (size_t i = 0; i < N; i++)
+				v.x[i] = from.x[i] + (to.x[i] - from.x[i]) * scale;
+			v.y = _objective(v.x);
+		}
 
-			void print(const char *c = NULL)
+		//Evaluate every vertex, in one batch if we can
+		void evaluateAll()
+		{
+			if (!hasBatch)
 			{
-				if (c)
-					std::cout << c << " ";
-				for (size_t i = 0; i < x.size(); i++)
-				{
-					std::cout << x[i] << " ";
-				}
-				std::cout << "    " << y << std::endl;
+				for (auto &v : _simplex)
+					v.y = _objective(v.x);
+				return;
 			}
-
-			//Comparison operators
-			bool operator < (vertex &v) { return y < v.y; };
-			bool operator <= (vertex &v) { return y <= v.y; };
-			bool operator >= (vertex &v) { return y >= v.y; };
-			bool operator > (vertex &v) { return y > v.y; };
-			bool operator == (vertex &v) { return y == v.y; };
-
-			vertex &operator += (const vertex &v)
-			{
-				x += v.x;
-				return *this;
-			};
-			vertex &operator -= (const vertex &v) { x -= v.x; return *this; };
-			vertex &operator /= (const double div) { x /= div; return *this; };
-			vertex &operator *= (const double m) { x *= m; return *this; };
-			vertex &operator / (double div) { x /= div;	return *this; };
-			vertex &operator = (const vertex &v) { _callback = v._callback;	x = v.x; y = v.y; return *this; };
-			vertex operator+ (const vertex &v1) { vertex sum = *this; sum += v1; return sum; };
-			vertex operator* (double m) { vertex sum = *this; sum *= m; return sum; };
-			vertex operator- (const vertex &v1) { vertex sum = *this; sum -= v1; return sum; };
-
-			double evaluate()
+			for (size_t k = 0; k < N + 1; k++)
 			{
-				y = _callback(x);
-				return y;
+				for (size_t d = 0; d < N; d++)
+					_points.coord[d][k] = _simplex[k].x[d];
 			}
-			std::function<double(std::valarray<double>)> _callback;
-			std::valarray<double> x;
-			double y;
-		};
-
-		bool converged(double threshold)
-		{
-			double a = WORST.y;
-			double b = BEST.y;
-			return ((a - b) < threshold);
-			//return b < threshold;
-		};
-
-		std::vector<vertex *> _simplex;		//A vector of vertices
-		std::function<double(std::valarray<double>)> _callback;
+			_batch(_points, _results.data());
+			for (size_t k = 0; k < N + 1; k++)
+				_simplex[k].y = _results[k];
+		}
 
+		Objective _objective;
+		Batch _batch;
+		std::default_random_engine _dre;
+		std::array<vertex, N + 1> _simplex;
+		pointBatch _points;
+		std::array<double, N + 1> _results;
+		int _iterations = { 0 };
 	};
 
+	template <size_t N, class Objective>
+	simplex<N, Objective> makeSimplex(Objective objective)
+	{
+		return simplex<N, Objective>(objective);
+	}
+
+	template <size_t N, class Objective, class Batch>
+	simplex<N, Objective, Batch> makeSimplex(Objective objective, Batch batch)
+	{
+		return simplex<N, Objective, Batch>(objective, batch);
+	}
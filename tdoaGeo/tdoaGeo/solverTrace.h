@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include "location.h"
+
+//The last points a solve tried and the cost at each, for display. The ring is sized once per solve and a new
+//point overwrites the oldest, so recording is a few stores however long the search runs. Several pool
+//threads may add at once. Each claims a position with one atomic increment, but once the ring has wrapped
+//two of them can land on the same slot, so a slot is only written by whoever marks it busy first and the
+//other's point is skipped. Only read it once they have all finished. With a capacity of 0 it is off and
+//add() must not be called.
+class solverTrace
+{
+public:
+	struct sample
+	{
+		point3 position;			//in the frame being solved in
+		double cost;
+	};
+	solverTrace() {};
+	~solverTrace() {};
+	void reset(size_t capacity)
+	{
+		if (capacity != _capacity)
+		{
+			_slots.reset(capacity > 0 ? new slot[capacity] : NULL);
+			_capacity = capacity;
+		}
+		_count = 0;
+		_skipped = 0;
+	};
+	bool enabled() const { return _capacity > 0; };
+	void add(const point3 &position, double cost)
+	{
+		slot &s = _slots[_count.fetch_add(1, std::memory_order_relaxed) % _capacity];
+		if (s.busy.exchange(true, std::memory_order_acquire))
+		{
+			_skipped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		s.value.position = position;
+		s.value.cost = cost;
+		s.busy.store(false, std::memory_order_release);
+	};
+	//Samples held, how many were overwritten, and how many lost to another thread writing the same slot
+	size_t size() const { return std::min(_count.load(), _capacity); };
+	size_t dropped() const { return _count.load() - size(); };
+	size_t skipped() const { return _skipped.load(); };
+	//Oldest first
+	template <class F> void forEach(F f) const
+	{
+		size_t count = _count.load();
+		for (size_t n = count - size(); n < count; n++)
+			f(_slots[n % _capacity].value);
+	};
+private:
+	struct slot
+	{
+		sample value = { { 0, 0, 0 }, 0 };
+		std::atomic<bool> busy = { false };
+	};
+	std::unique_ptr<slot[]> _slots;
+	size_t _capacity = { 0 };
+	std::atomic<size_t> _count = { 0 };
+	std::atomic<size_t> _skipped = { 0 };
+};
@@ -2,88 +2,328 @@
 
 tdoa::tdoa() {}
 
-tdoa::~tdoa() {}
+tdoa::~tdoa()
+{
+	cohort *c;
+	while (_spareCohorts.tryFront(c))
+	{
+		_spareCohorts.pop();
+		delete c;
+	}
+}
 
 //Function which returns the rms time error at the point passed. The search aims
 //to minimise the error. That is find coordinates which give consistent time differences
-//to those held in _timeDeltas
-double tdoa::error(std::valarray<double> &xyz)
+//to those measured. The arithmetic is in the cohort's tdoaCost.
+double tdoa::error(cohort &c, const double *xyz, size_t dimensions)
 {
-	//Calculate the time of flight from the location passed to each of the nodes.
-	std::vector<double> time;
-	//Convert valarray to a point in space
-	location loc;
-
-	//If there are only two points then assume search is constrained to the surface of the earth
-	if (xyz.size() < 3 || _threeDimensions == false)
-		loc.setCartesian(xyz[0], xyz[1]);
-	else
-		loc.setCartesian(xyz[0], xyz[1], xyz[2]);
+	double result = c._cost.evaluate(xyz, dimensions);
+	if (c._trace.enabled() && result != std::numeric_limits<double>::max())
+		record(c, xyz, dimensions, result);
+	return result;
+}
 
-	//If more than 100km or below min altitude then consider it invalid
-	if (loc.distance(_locations[0]) > 100000 || loc.getAlt() < _minAltitude)
-		return std::numeric_limits<double>::max();
-	std::vector<double> metres;
-	for (size_t i = 0; i < _locations.size(); i++)
-	{
-		double m = loc.distance(_locations[i]);
-		metres.push_back(m);
-		double seconds = m / SPEED_OF_LIGHT;
-		//Convert to time of flight in ns
-		time.push_back(1e9 * m / SPEED_OF_LIGHT);
-	}
-	double result = 0;
-	//std::lock_guard<std::mutex> lck(cout_mtx);
-	//Calculate the square of the difference of this guess from the measured values  
-	for (size_t i = 0; i < _locations.size(); i++)
+//Batch form of error() for the optimisers
+void tdoa::errors(cohort &c, const pointBatch &points, double *rms)
+{
+	c._cost.evaluate(points, rms);
+	if (c._trace.enabled())
 	{
-		double difference = time[i] - time[0];
-		//if(_debug.is_open())
-		//	_debug << loc.getLat() << ", " << loc.getLon() << " " << loc.getAlt() << "m " << _locations[i].getLat() << ", " << _locations[i].getLon() << " " << _locations[i].getAlt() << "m " << loc.distance(_locations[i])
-		//			 << "m calc delta: " << difference << "ns meas delta " << _locations[i]._timeDelta << "ns" << std::endl;
-		difference -= _locations[i]._timeDelta;
-		result += pow(difference, 2);
+		double xyz[3];
+		size_t dimensions = std::min<size_t>(points.coord.size(), 3);
+		for (size_t k = 0; k < points.count; k++)
+		{
+			if (rms[k] == std::numeric_limits<double>::max())
+				continue;
+			for (size_t d = 0; d < dimensions; d++)
+				xyz[d] = points.coord[d][k];
+			record(c, xyz, dimensions, rms[k]);
+		}
 	}
-	result = sqrt(result / _locations.size());
-	//if (_debug.is_open())
-	//{
-	//	_debug << " rms: " << result << "ns" << std::endl;
-	//	_debug.flush();
-	//}
-	if (!_heatMapOn)
+}
+
+//Keep a point the search visited for display, if tracing
+void tdoa::record(cohort &c, const double *xyz, size_t dimensions, double rms)
+{
+	//If there are only two points then assume search is constrained to the surface of the earth
+	bool surface = dimensions < 3 || _threeDimensions == false;
+	point3 enu = { xyz[X], xyz[Y], surface ? enuFrame::surface(xyz[X], xyz[Y]) : xyz[Z] };
+	c._trace.add(enu, rms);
+}
+
+//Evaluate the error at points given by distance (m) and bearing (deg) from the target, all in one batch
+void tdoa::errorsAround(cohort &c, const double *distance, const double *bearing, size_t count, double *rms)
+{
+	thread_local pointBatch points;
+	points.resize(3, count);
+	for (size_t k = 0; k < count; k++)
 	{
-		loc._error = result;
-		_heatmap.push_back(loc);
+		point3 position = c._frame.move(c._target, distance[k], bearing[k]);
+		points.coord[X][k] = position.x;
+		points.coord[Y][k] = position.y;
+		points.coord[Z][k] = position.z;
 	}
-	return result;
+	errors(c, points, rms);
 }
 
 //Function which returns the rmsError at 100m from centre at the specified angle.
 //Used by the optimiser in locating the ellipse minor axis bearing
-double tdoa::gradient(std::valarray<double> &alpha)
+double tdoa::gradient(cohort &c, double alpha)
 {
-	location loc = _target;
-	loc.move(1000, RAD_TO_DEG(alpha[0]));
-	std::valarray<double> position(3);
-	loc.getCartesian(position);
+	point3 p = c._frame.move(c._target, 1000, RAD_TO_DEG(alpha));
+	double position[3] = { p.x, p.y, p.z };
 	//Look for the minimum
-	return error(position);
+	return error(c, position, 3);
 }
 
 //Function which returns the error relative at the defined distance from the centre at angle _bearing.
 //Used by the optimiser in finding the major & minor axis lengths
-double tdoa::excessError(std::valarray<double> &distance)
+double tdoa::excessError(cohort &c, double distance, double bearing)
 {
-	if(distance[0] < 0)
+	if(distance < 0)
 		return std::numeric_limits<double>::max();
-	location loc = _target;
-	loc.move(distance[0], _bearing);
-	std::valarray<double> position(3);
-	loc.getCartesian(position);
+	point3 p = c._frame.move(c._target, distance, bearing);
+	double position[3] = { p.x, p.y, p.z };
 	//Look for the maximum
-	return std::abs(_rmsError - error(position));
+	return std::abs(_rmsError - error(c, position, 3));
+}
+
+//Batch forms of gradient() and excessError()
+void tdoa::gradients(cohort &c, const pointBatch &alpha, double *rms)
+{
+	std::vector<double> distance(alpha.count, 1000), bearing(alpha.count);
+	for (size_t k = 0; k < alpha.count; k++)
+		bearing[k] = RAD_TO_DEG(alpha.coord[0][k]);
+	errorsAround(c, &distance[0], &bearing[0], alpha.count, rms);
+}
+
+void tdoa::excessErrors(cohort &c, const pointBatch &distance, double bearing, double *excess)
+{
+	std::vector<double> bearings(distance.count, bearing);
+	errorsAround(c, &distance.coord[0][0], &bearings[0], distance.count, excess);
+	for (size_t k = 0; k < distance.count; k++)
+		excess[k] = distance.coord[0][k] < 0 ? std::numeric_limits<double>::max() : std::abs(_rmsError - excess[k]);
+}
+
+//Solve for the position with Levenberg-Marquardt on the residuals behind error(). Starts from xyz, or if that
+//is empty from the middle of the nodes, and overwrites it with the answer in as many dimensions as the
+//simplex would search. Returns its rms error.
+double tdoa::leastSquares(cohort &c, std::valarray<double> &xyz)
+{
+	if (xyz.size() == 0)
+	{
+		//The master itself won't do as the direction to it is undefined there. Take the middle of the nodes
+		//at their average height, as straight between them is below the surface.
+		double x = 0, y = 0, height = 0;
+		for (auto &p : c._positions)
+		{
+			point3 enu = c._frame.toLocal(p);
+			x += enu.x;
+			y += enu.y;
+			height += enu.z - enuFrame::surface(enu.x, enu.y);
+		}
+		double n = static_cast<double>(c._positions.size());
+		x /= n;
+		y /= n;
+		xyz.resize(c._positions.size() < 4 || _threeDimensions == false ? 2 : 3);
+		xyz[X] = x;
+		xyz[Y] = y;
+		if (xyz.size() > 2)
+			xyz[Z] = enuFrame::surface(x, y) + height / n;
+	}
+	levenbergMarquardt lm([this, &c](const std::valarray<double> &x, std::valarray<double> &r, std::valarray<double> &jacobian)
+	{
+		bool valid = c._cost.residuals(x, r, jacobian);
+		if (valid && c._trace.enabled())
+			record(c, &x[0], x.size(), sqrt((r * r).sum() / r.size()));
+		return valid;
+	});
+	double confidence = lm.optimise(xyz, 50, 1e-6);
+	c._normal = lm.normal();
+	return confidence;
+}
+
+//The ellipse where the rms error reaches _rmsError, from the linearised error at the fix rather than by
+//searching for it. With M = JtJ / nodes for moves east and north, the error squared grows by d.M.d for a move
+//d, so the axes lie along the eigenvectors of M with half lengths sqrt((_rmsError^2 - rms^2) / eigenvalue).
+//That is the timing error times the dilution of precision along each axis. Symmetric, so centred on the fix.
+void tdoa::analyticEllipse(cohort &c, std::valarray<double> &xyz, double rms, ellipse &e)
+{
+	std::valarray<double> r, jacobian;
+	c._cost.residuals(xyz, r, jacobian);
+	const size_t dims = xyz.size();
+	//East and north at the fix, which turn slightly from those of the cohort's frame with distance from its origin
+	point3 eastward, northward;
+	c._frame.horizon(c._target, eastward, northward);
+	const double east[3] = { eastward.x, eastward.y, eastward.z }, north[3] = { northward.x, northward.y, northward.z };
+	//On the surface z follows x and y and the jacobian already allows for it
+	double a = 0, b = 0, d = 0;
+	for (size_t i = 0; i < r.size(); i++)
+	{
+		double je = 0, jn = 0;
+		for (size_t k = 0; k < dims && k < 3; k++)
+		{
+			je += jacobian[i * dims + k] * east[k];
+			jn += jacobian[i * dims + k] * north[k];
+		}
+		a += je * je;
+		b += je * jn;
+		d += jn * jn;
+	}
+	a /= r.size();
+	b /= r.size();
+	d /= r.size();
+	double mean = (a + d) / 2;
+	double spread = sqrt((a - d) * (a - d) / 4 + b * b);
+	double small = mean - spread, large = mean + spread;
+	double level = std::max(_rmsError * _rmsError - rms * rms, 0.0);
+	//Flat along an axis means the geometry can't resolve it, limit it to the search area
+	auto axis = [level](double eigenvalue) { return eigenvalue > 0 ? std::min(sqrt(level / eigenvalue), 100000.0) : 100000.0; };
+	e._major = 2 * axis(small);
+	e._minor = 2 * axis(large);
+	//Major axis along the eigenvector of the smaller eigenvalue, as a bearing from north. With no cross term
+	//the axes are east and north already.
+	double ve = b, vn = small - a;
+	if (b == 0)
+	{
+		ve = a <= d ? 1 : 0;
+		vn = a <= d ? 0 : 1;
+	}
+	c._bearing = RAD_TO_DEG(atan2(ve, vn));
+	//As the contour search leaves it
+	e._angle = c._bearing + 90;
+	e._centre = c._frame.toLocation(c._target);
+}
+
+//Simplex search for the position in N dimensions starting around xyz, which is overwritten with the result.
+//Gives up early if stop is set.
+template <size_t N>
+double tdoa::searchPosition(cohort &c, std::valarray<double> &xyz, double spread, uint32_t seed, const std::atomic<bool> *stop)
+{
+	//Tell the optimiser how to calculate error function values
+	auto splx = makeSimplex<N>([this, &c](const std::array<double, N> &d) { return error(c, d.data(), N); },
+							   [this, &c](const pointBatch &p, double *r) { errors(c, p, r); });
+	splx.reset(seed);
+	std::array<double, N> position;
+	std::copy(std::begin(xyz), std::end(xyz), position.begin());
+	double confidence = splx.optimise(position, spread, 1e-6, stop);
+	std::copy(position.begin(), position.end(), std::begin(xyz));
+	return confidence;
+}
+
+//The simplex from several starts at once on the pool, keeping the best. The first is a short way round the
+//closed form estimate, or the master if there is none. The rest start further out, scattered round it on a
+//golden angle spiral so between them they cover the ground rather than all setting off from one place.
+//Once any start gets under _badThreshold the rest give up, so this takes about as long as one search.
+//Returns the rms error and leaves the answer in xyz.
+double tdoa::multiStart(cohort &c, const std::valarray<double> &estimate, std::valarray<double> &xyz)
+{
+	std::valarray<double> centre(estimate.size());
+	if (estimate.size() > 0)
+		centre = estimate;
+	else
+	{
+		point3 master = c._frame.toLocal(c._positions.front());
+		centre.resize(c._positions.size() < 4 || _threeDimensions == false ? 2 : 3);
+		centre[X] = master.x;
+		centre[Y] = master.y;
+		if (centre.size() > 2)
+			centre[Z] = master.z;
+	}
+	ThreadPool &pool = ThreadPool::shared();
+	std::atomic<bool> stop(false);
+	size_t starts = std::max<size_t>(_starts, 1);
+	std::vector<std::valarray<double>> answers(starts, centre);
+	std::vector<std::future<double>> ftrs;
+	for (size_t k = 0; k < starts; k++)
+	{
+		double spread = k == 0 && estimate.size() > 0 ? 100 : 1000;
+		if (k > 0)
+		{
+			//Out to twice the spread, the last start furthest away
+			double radius = 2000 * sqrt(static_cast<double>(k) / (starts - 1));
+			double angle = k * PI * (3 - sqrt(5.0));
+			answers[k][X] += radius * cos(angle);
+			answers[k][Y] += radius * sin(angle);
+		}
+		//Repeatable for a cohort but different for each start
+		uint32_t seed = static_cast<uint32_t>(c._key) + static_cast<uint32_t>(k);
+		std::valarray<double> *answer = &answers[k];
+		ftrs.push_back(pool.submit([this, &c, &stop, answer, spread, seed]()
+		{
+			double rms;
+			if (answer->size() < 3)
+				rms = searchPosition<2>(c, *answer, spread, seed, &stop);
+			else
+				rms = searchPosition<3>(c, *answer, spread, seed, &stop);
+			if (rms < _badThreshold)
+				stop = true;
+			return rms;
+		}));
+	}
+	//Everything must finish before the answers go out of scope
+	double best = std::numeric_limits<double>::max();
+	for (size_t k = 0; k < starts; k++)
+	{
+		double rms = pool.wait(ftrs[k]);
+		if (rms < best)
+		{
+			best = rms;
+			xyz.resize(answers[k].size());
+			xyz = answers[k];
+		}
+	}
+	return best;
+}
+
+//Search from where the tracker expects the emitter, over about as far as it may be from there. Leaves the
+//answer in xyz in as many dimensions as given and returns its rms error.
+double tdoa::warmStart(cohort &c, const point3 &expected, double sigma, size_t dimensions, std::valarray<double> &xyz)
+{
+	point3 enu = c._frame.toLocal(expected);
+	xyz.resize(dimensions);
+	xyz[X] = enu.x;
+	xyz[Y] = enu.y;
+	if (dimensions > 2)
+		xyz[Z] = enu.z;
+	if (_solver == SOLVER_LEVENBERG_MARQUARDT)
+		return leastSquares(c, xyz);
+	double spread = std::min(std::max(2 * sigma, 1.0), 1000.0);
+	uint32_t seed = static_cast<uint32_t>(c._key);
+	return dimensions < 3 ? searchPosition<2>(c, xyz, spread, seed) : searchPosition<3>(c, xyz, spread, seed);
 }
 
+//On a fixed deployment, the cell of the precomputed grid whose delays best match those measured. It replaces
+//the closed form estimate in seed if it fits better, or if there was none. Nothing happens unless every node
+//of the cohort is in the grid and where the grid has it.
+void tdoa::gridSeed(cohort &c, size_t dimensions, std::valarray<double> &seed)
+{
+	std::shared_ptr<const tdoaGrid::table> grid = _grid.snapshot();
+	if (!grid)
+		return;
+	std::vector<int> nodes(c._positions.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		nodes[i] = grid->index(c._nodeInfo[i]._host, c._nodeInfo[i]._port, c._positions[i], _gridTolerance_m);
+		if (nodes[i] < 0)
+			return;
+	}
+	point3 best;
+	double rms;
+	if (!grid->match(&nodes[0], &c._delays[0], nodes.size(), best, rms))
+		return;
+	point3 enu = c._frame.toLocal(best);
+	std::valarray<double> candidate(dimensions);
+	candidate[X] = enu.x;
+	candidate[Y] = enu.y;
+	if (dimensions > 2)
+		candidate[Z] = enu.z;
+	if (seed.size() == 0 || c._cost.evaluate(candidate) < c._cost.evaluate(seed))
+	{
+		seed.resize(dimensions);
+		seed = candidate;
+	}
+}
 
 //Get time difference between two data sets
 int32_t tdoa::correlate(capture *master, capture *slave)
@@ -115,236 +355,311 @@ int32_t tdoa::correlate(capture *master, capture *slave)
 		return ns;
 	}
 
-	//Nodes performed FFT so we already have the spectra and master should be conjugated
-	//Multiply together and invert the FFT
-	slave->iqData *= master->iqData;
-	fft fourier;
-	fourier.invert(slave->iqData);
-	slave->iqData = slave->iqData.cshift(slave->iqData.size() / 2);
-	//Copy absolute values from complex result
-	std::vector<double>correlation(slave->iqData.size());
-	for (size_t i = 0; i < correlation.size(); i++)
+	//The delay can be no more than the separation of the nodes over c, plus whatever the synchronisers may be
+	//out by, so only lags within that are searched. This is cheaper and cannot lock on to an impossible peak.
+	double sampleTime = static_cast<double>(decimation * 1000) / static_cast<double>(sampleRate);	//ns
+	int32_t maxLag = 0;
+	if (_lagWindow && master->_gfix != 0 && slave->_gfix != 0)
 	{
-		correlation[i] = std::abs(slave->iqData[i]);
+		location m(master->_lati / 1e6, master->_long / 1e6, master->_alti / 1e3);
+		location s(slave->_lati / 1e6, slave->_long / 1e6, slave->_alti / 1e3);
+		double maxDelay = 1e9 * m.distance(s) / SPEED_OF_LIGHT + _syncMargin_ns;
+		maxLag = static_cast<int32_t>(ceil(maxDelay / sampleTime)) + 1;
 	}
 
-	if (correlation.size() > 0)
+	//Nodes performed FFT so we already have the spectra. Multiply the slave by the conjugate of the master,
+	//invert and search for the peak in a single fused kernel.
+	fft fourier;
+	correlationPeak correlation;
+	fourier.correlate(master->iqData, slave->iqData, correlation, _refinement, maxLag);
+
+	if (slave->iqData.size() > 0)
 	{
-		auto max = std::max_element(correlation.begin(), correlation.end());
-		//Return the peak sample
-		int32_t offset = static_cast<int32_t>(std::distance(correlation.begin(), max));
-		double sum = std::accumulate(correlation.begin(), correlation.end(), 0.0);
-		double peak = *max;
-		double mean = sum / correlation.size();
-		double peakToMean = peak / mean;
+		//Return the peak, refined below a sample if configured
+		double offset = correlation.delay;
+		double peakToMean = correlation.peakToMean;
 		//Cross correlation is lousy so assume we've lost it
 		if (peakToMean < 5)
 		{
 			std::cout << "peakToMean " << peakToMean << std::endl;
 			return ns;
 		}
-		offset -= correlation.size() / 2;
 
-		double sampleTime = static_cast<double>(decimation * 1000) / static_cast<double>(sampleRate);	//ns
-		ns = static_cast<int32_t>(offset * sampleTime);
+		ns = static_cast<int32_t>(std::lround(offset * sampleTime));
 		//std::lock_guard<std::mutex> lk(cout_mtx);
 		//std::cout << slave->_port << " vs " << master->_port <<  " offset " << offset << " at " << sampleTime << "ns = " << ns << "ns " << peakToMean << std::endl;
 	}
 	return ns;
 }
 
-void tdoa::process(uint64_t key)
+//Solve for the emitter location from one cohort of captures. Runs on the pool, so everything it changes is
+//in the cohort. Returns NULL if there is no usable fix.
+std::unique_ptr<tdoaResult> tdoa::solve(cohort &c)
 {
-	//The set of captures that we're going to process
-	//std::cout << "processing " << key << " ";
-	if (_packets.find(key) == _packets.end())
-		return;
-	_heatmap.clear();
-	_locations.clear();
-	if (_packets[key]->size() > 2)
+	std::vector<capture *> &packets = c._captures;
+	std::unique_ptr<tdoaResult> result;
+	if (packets.size() > 2)
 	{
 		//Sort in order of power
-		std::sort(_packets[key]->begin(), _packets[key]->end(), [](const capture *a, const capture *b)
+		std::sort(packets.begin(), packets.end(), [](const capture *a, const capture *b)
 		{
 			return a->_power > b->_power;
 		});
 		//Master is the one with highest power
-		auto master = _packets[key]->front();
+		auto master = packets.front();
 		//Avoid overdetermined condition by using only the 3/4 strongest nodes
 		size_t count = 3;
 		if (_threeDimensions)
 			count = 4;
-		while (_packets[key]->size() > count)
+		while (packets.size() > count)
 		{
-			_packets[key]->pop_back();
+			packets.back()->release();
+			packets.pop_back();
 		}
 
-		//Conjugate the master
-		master->iqData = master->iqData.apply(std::conj);
-		//Run the correlations concurrently. correlation returns ns	
+		//Run the correlations concurrently on the shared pool. correlation returns ns. The master is only read.
+		ThreadPool &pool = ThreadPool::shared();
 		std::vector<std::future<int32_t>> ftrs;
-		for (auto pkt : *_packets[key])
-			ftrs.push_back(std::async(std::launch::async, &tdoa::correlate, this, master, pkt));
+		for (auto pkt : packets)
+			ftrs.push_back(pool.submit([this, master, pkt]() { return correlate(master, pkt); }));
 
 		//Iterate over the futures to get the time differences from master. Each future will block until completed.
 		//The master is the front entry in the vector, so make sure we observe the sorted order of the packets. 
 		size_t i = 0;
 		for (auto &ftr: ftrs)
 		{
-			int32_t ns = ftr.get();
+			int32_t ns = pool.wait(ftr);
 			if (ns != std::numeric_limits<int32_t>::max())
 			{
-				capture *pkt = _packets[key]->at(i++);
+				capture *pkt = packets.at(i++);
 				//std::cout << key << " " << pkt->_lati / 1e6 << " " << pkt->_long / 1e6 << " " << ns << "ns" << std::endl;
 				location loc(pkt->_lati / 1e6, pkt->_long / 1e6, pkt->_alti / 1e3);
-				loc._timeDelta = ns;
-				loc._power = pkt->_power;
-				loc._gain = pkt->_gain;
-				loc._port = pkt->_port;
-				loc._host = pkt->_host;
-				//Save location of the node in the array
-				_locations.push_back(loc);
+				//Save location of the node in the arrays
+				c._positions.push_back(loc.getCartesian());
+				c._delays.push_back(ns);
+				nodeInfo info = { pkt->_power, pkt->_gain, pkt->_port, pkt->_host };
+				c._nodeInfo.push_back(info);
 			}
 		}
 		//Now have everything needed to solve for location so long as we have at least 3 nodes
 		//If not enough locations to geolocate then don't bother.
+		//Solve in east, north and up about the middle of the nodes
+		if (c._positions.size() > 0)
+		{
+			//Only the direction of the anchor matters
+			point3 middle = { 0, 0, 0 };
+			for (auto &p : c._positions)
+			{
+				middle.x += p.x;
+				middle.y += p.y;
+				middle.z += p.z;
+			}
+			location anchor;
+			anchor.setCartesian(middle);
+			c._frame.setOrigin(anchor);
+		}
+		c._cost.setNodes(c._positions, c._delays, c._frame, _threeDimensions, _minAltitude);
+		c._trace.reset(_traceSamples);
 		double confidence = _badThreshold + 1;
 		std::valarray<double> xyz(2);
-		tdoaResult *result = new tdoaResult;
-		if (_locations.size() > 2)
+		if (c._positions.size() > 2)
 		{
-			//Give the optimiser a second chance if needed
-			for (int i = 0; i < 2 && confidence >= _badThreshold; i++)
+			result.reset(new tdoaResult);
+			//Closed form estimate for the solvers to polish. If have only 3 nodes the search is constrained
+			//to the surface of the earth by using only x and y.
+			size_t dimensions = c._positions.size() < 4 || _threeDimensions == false ? 2 : 3;
+			std::valarray<double> seed(dimensions);
+			if (!c._cost.estimate(seed))
+				seed.resize(0);
+			gridSeed(c, dimensions, seed);
+			//If tracking, first a short search from where the emitter is expected to be
+			point3 expected;
+			double sigma;
+			if (_tracker.predict(master->_time, expected, sigma))
+				confidence = warmStart(c, expected, sigma, dimensions, xyz);
+			//Otherwise, or if the emitter wasn't there, from scratch
+			if (confidence >= _badThreshold && _solver == SOLVER_LEVENBERG_MARQUARDT)
 			{
-				//Use master position as start of search for optimum
-				_locations.front().getCartesian(xyz);
-
-				if (_locations.size() < 4 || _threeDimensions == false)
-				{	
-					double x = xyz[X];
-					double y = xyz[Y];
-					xyz.resize(2);
-					xyz[X] = x;
-					xyz[Y] = y;
-				}
-				//Tell the optimiser how to calculate error function values 
-				using namespace std::placeholders;
-				simplex splx(std::bind(&tdoa::error, this, _1));
-				//Optimise overwrites xyz with result. If have only 3 nodes we should constrain the 
-				//search to the surface of the earth. This is done by passing only x and y data to the
-				//solver
-				confidence = splx.optimise(xyz, 1000, 1e-6);
-				//std::cout << "attempt " << i << " confidence " << confidence << std::endl;
+				xyz.resize(seed.size());
+				xyz = seed;
+				confidence = leastSquares(c, xyz);
 			}
+			//Otherwise, or if that failed, the simplex. If have only 3 nodes it is constrained to the surface
+			//of the earth by passing only x and y data to the solver.
+			if (confidence >= _badThreshold)
+				confidence = multiStart(c, seed, xyz);
 
 			if (confidence < _badThreshold)
 			{
 				result->_target._timeStamp = master->_time;
-				//Optimisation carried out in cartesian space. Convert back to spherical
-				result->_target._centre.setCartesian(xyz);
-				_target = result->_target._centre;
+				//Optimisation carried out in the cohort's frame. Convert back, to spherical when it is read.
+				result->_target._centre = c._frame.toLocation(&xyz[0], xyz.size());
 				result->_target._centre._error = confidence;
+				c._target = c._frame.toLocal(result->_target._centre);
 
-				result->_nodes = _locations;
-				location best = result->_target._centre;
+				result->_nodes.swap(c._positions);
+				//Tiles of the map are spread over the pool. Only done in full where the error is under the level
+				//the ellipse is drawn at.
 				if (_heatMapOn)
+					_heatMap.build(c._cost, c._frame, c._target, _rmsError, result->_heatmap);
+
+				if (_ellipseMode == ELLIPSE_CONTOUR)
 				{
-					_heatmap.clear();
-					for (double lat = result->_target._centre.getLat() - 0.01; lat < result->_target._centre.getLat() + 0.01; lat += 0.0002)
+					//Find the minor axis of the elipse. This involves searching for the direction with the maximum uphill gradient.
+					//This is more robust than searching for the major axis which may lie along a valley. Use the optimiser as it will
+					//require far fewer iterations than a brute force search.
+					std::array<double, 1> alpha = { { 0 } };	//radians
+					auto splx = makeSimplex<1>([this, &c](const std::array<double, 1> &a) { return gradient(c, a[0]); },
+											   [this, &c](const pointBatch &p, double *r) { gradients(c, p, r); });
+					//Optimise overwrites alpha with result.
+					splx.optimise(alpha, PI/8, 1e-3);
+
+					c._bearing = (180 * alpha[0] / PI);
+					result->_target._ellipse._angle = c._bearing + 90;
+					//Now we have the orientation of the ellipse search for the defined rms error. The two directions
+					//along the major axis are independent searches so run concurrently.
+					auto axisSearch = [this, &c](double bearing, double start, double spread)
 					{
-						for (double lon = result->_target._centre.getLon() - 0.02; lon < result->_target._centre.getLon() + 0.02; lon += 0.0005)
-						{
-							location loc(lat, lon, result->_target._centre.getAlt());
-							std::valarray<double> map(3);
-							loc.getCartesian(map);
-							loc._error = error(map);
-							if (loc._error < best._error)
-								best = loc;
-							_heatmap.push_back(loc);
-						}
-					}
+						auto splx2 = makeSimplex<1>([this, &c, bearing](const std::array<double, 1> &distance) { return excessError(c, distance[0], bearing); },
+													[this, &c, bearing](const pointBatch &p, double *r) { excessErrors(c, p, bearing, r); });
+						//Optimise overwrites shift with result.
+						std::array<double, 1> shift = { { start } };
+						splx2.optimise(shift, spread, 1);
+						return shift[0];
+					};
+					double bearing = c._bearing;
+					auto forward = pool.submit([=]() { return axisSearch(bearing, 1000, 100); });
+					auto reverse = pool.submit([=]() { return axisSearch(bearing - 180, 1000, 100); });
+					double offset1 = pool.wait(forward);
+					double offset2 = pool.wait(reverse);
+					c._bearing -= 180;
+					result->_target._ellipse._major = offset1 + offset2;
+					//Shift the ellipse centre along the major axis
+					c._target = c._frame.move(c._target, (offset2 - offset1) / 2, c._bearing);
+					result->_target._ellipse._centre = c._frame.toLocation(c._target);
+					//finally do minor axis
+					c._bearing += 90;
+					result->_target._ellipse._minor = 2 * axisSearch(c._bearing, offset2 / 4, 10);
 				}
+				else
+					analyticEllipse(c, xyz, confidence, result->_target._ellipse);
 
-				//Find the minor axis of the elipse. This involves searching for the direction with the maximum uphill gradient.
-				//This is more robust than searching for the major axis which may lie along a valley. Use the optimiser as it will
-				//require far fewer iterations than a brute force search.
-				std::valarray<double> alpha(1);			//radians
-				using namespace std::placeholders;
-				simplex splx(std::bind(&tdoa::gradient, this, _1));
-				//Optimise overwrites alpha with result.
-				splx.optimise(alpha, PI/8, 1e-3);
-
-				_bearing = (180 * alpha[0] / PI);
-				result->_target._ellipse._angle = _bearing + 90;
-				//Now we have the orientation of the ellipse search for the defined rms error
-				simplex splx2(std::bind(&tdoa::excessError, this, _1));
-				//Optimise overwrites shift with result.
-				std::valarray<double> shift{ 1000 };
-				splx2.optimise(shift, 100, 1);
-				double offset1 = shift[0];
-				//Repeat for the major axis in opposite direction
-				_bearing -= 180;
-				splx2.optimise(shift, 100, 1);
-				double offset2 = shift[0];
-				result->_target._ellipse._major = offset1 + offset2;
-				result->_target._ellipse._centre = _target;
-				//Shift the ellipse centre along the major axis
-				result->_target._ellipse._centre.move((offset2 - offset1) / 2, _bearing);
-				_target = result->_target._ellipse._centre;
-				//finally do minor axis
-				shift[0] /= 4;
-				_bearing += 90;
-				splx2.optimise(shift, 10, 1);
-				result->_target._ellipse._minor = 2 * shift[0];
-
-				result->_heatmap = _heatmap;
-				_resultQ->push(result);
-				if (_debug.is_open())
-					_debug << result->_target._centre.getLat() << ", " << result->_target._centre.getLon() << ", " << result->_target._centre.getAlt() << std::endl;
+				//Everything that may add to the trace has finished
+				result->_visited.reserve(c._trace.size());
+				c._trace.forEach([&c, &result](const solverTrace::sample &s)
+				{
+					mapPoint visited = { c._frame.toEarth(s.position, false), s.cost };
+					result->_visited.push_back(visited);
+				});
 				std::lock_guard<std::mutex> lk(cout_mtx);
 				std::cout << "result " << result->_target._centre.getLat() << ", " << result->_target._centre.getLon() << " " << result->_target._centre.getAlt() << "m " << confidence << std::endl;
-				//for (auto l : _locations)
+				//for (auto &n : c._nodeInfo)
 				//{
-				//	std::cout << l._port << " power: " << l._power << " gain: " << l._gain << std::endl;
+				//	std::cout << n._port << " power: " << n._power << " gain: " << n._gain << std::endl;
 				//}
 			}
 			else
 			{
-				delete result;
+				result.reset();
 				std::cout << "bad result " << confidence << std::endl;
 			}
 		}
 		//if (_debug.is_open())
 		//	_debug.close();
 	}
-	//clean up
-	//std::cout << "deleting " << key << " entries " << _packets[key]->size() << std::endl;
-	for (auto pos : *_packets[key])
-		delete pos;
-
-	_packets.erase(key);
+	return result;
 }
 
-void tdoa::manageBuffer()
+//Hand a set of captures from the aligner to the pool. The result is passed on by release() once it can go
+//out in order.
+void tdoa::process(alignedSet &set)
 {
-	if (_packets.size() == 0)
+	//The set of captures that we're going to process
+	//std::cout << "processing " << set._time << " ";
+	int64_t key = set._time;
+	cohort *c;
+	if (_spareCohorts.tryFront(c))
+		_spareCohorts.pop();
+	else
+		c = new cohort;
+	c->_key = key;
+	//Take the captures, the aligner keeps the vector they came in
+	c->_captures.swap(*set._captures);
+	_aligner.recycle(set._captures);
+	if (c->_captures.size() < 3)
+	{
+		recycle(c);
 		return;
-	//Once buffer has reached maximum size, delete the oldest 
-	if (_packets.size() > 5)
-		process(_packets.begin()->first);
-		
-	for (auto pkts : _packets)
+	}
+	ThreadPool &pool = ThreadPool::shared();
+	size_t limit = _maxInFlight > 0 ? _maxInFlight : pool.size();
+	std::multimap<int64_t, inFlight>::iterator slot;
 	{
-		//If we have all the node packets then process
-		if ((pkts.second->size()) == _nodes.size())
-		{
-			process(pkts.first);
-			//Recursively process one entry as deletion corrupts iterator loop
-			manageBuffer();
+		//Stop taking in more work if the solvers can't keep up
+		std::unique_lock<std::mutex> lk(_inFlightMtx);
+		_solved.wait(lk, [this, limit] { return _running < limit; });
+		slot = _inFlight.insert(std::make_pair(key, inFlight()));
+		_running++;
+	}
+	pool.submit([this, c, slot]()
+	{
+		std::unique_ptr<tdoaResult> result = solve(*c);
+		recycle(c);
+		std::lock_guard<std::mutex> lk(_inFlightMtx);
+		slot->second.result = std::move(result);
+		slot->second.done = true;
+		_running--;
+		release();
+		_solved.notify_all();
+	});
+}
+
+//Done with a cohort, from any thread. Its captures go back to their nodes and it is kept for another set.
+void tdoa::recycle(cohort *c)
+{
+	c->clear();
+	if (!_spareCohorts.tryPush(c))
+		delete c;
+}
+
+//Pass finished results on in timestamp order. Must be called holding _inFlightMtx, so it never waits for the
+//display: if the results ring is full the result is dropped and counted rather than holding up the pool.
+void tdoa::release()
+{
+	while (!_inFlight.empty())
+	{
+		auto oldest = _inFlight.begin();
+		//Wait for it to be solved, and for anything older still buffered to be dispatched
+		if (!oldest->second.done || oldest->first >= _oldestBuffered)
 			break;
+		std::unique_ptr<tdoaResult> &result = oldest->second.result;
+		if (result)
+		{
+			//Fixes reach the tracker in time order here. If smoothing, pass on its estimate instead.
+			if (_tracker.enabled())
+			{
+				point3 fix = result->_target._centre.getCartesian();
+				point3 raw = fix;
+				if (_tracker.update(result->_target._timeStamp, fix) && _trackSmooth)
+				{
+					result->_target._centre.setCartesian(fix);
+					//Take the ellipse along with it so it stays round the marker
+					location &centre = result->_target._ellipse._centre;
+					point3 e = centre.getCartesian();
+					e.x += fix.x - raw.x;
+					e.y += fix.y - raw.y;
+					e.z += fix.z - raw.z;
+					centre.setCartesian(e);
+				}
+			}
+			//The display owns it once it is pushed
+			if (_debug.is_open())
+				_debug << result->_target._centre.getLat() << ", " << result->_target._centre.getLon() << ", " << result->_target._centre.getAlt() << std::endl;
+			if (!_resultQ->tryPush(std::move(result)))
+				_dropped++;
 		}
+		_inFlight.erase(oldest);
 	}
-	//std::cout << "size = " << _packets.size() << std::endl;
 }
 
 void tdoa::setParams(Json::Value config)
@@ -356,9 +671,26 @@ void tdoa::setParams(Json::Value config)
 	Json::Value nodes = config["nodes"];
 	Json::Value tdoa = config["tdoa"];
 	_heatMapOn = tdoa.get("heatMapOn", _heatMapOn).asBool();
+	_traceSamples = tdoa.get("traceSamples", static_cast<Json::UInt>(_traceSamples)).asUInt();
+	std::string tracking = tdoa.get("tracking", "off").asString();
+	_tracker.configure(tracking == "velocity" ? TRACK_VELOCITY : tracking == "position" ? TRACK_POSITION : TRACK_OFF,
+					   tdoa.get("trackFixError_m", 30).asDouble(), tdoa.get("trackNoise", 1).asDouble(),
+					   tdoa.get("trackGate", 5).asDouble(), tdoa.get("trackMisses", 3).asInt(), tdoa.get("trackTimeout_s", 10).asDouble());
+	_trackSmooth = tdoa.get("trackSmooth", _trackSmooth).asBool();
+	_heatMap.configure(tdoa.get("heatMapSize_m", 2500).asDouble(), tdoa.get("heatMapSpacing_m", 25).asDouble(), tdoa.get("heatMapCoarse", 4).asUInt());
 	_threeDimensions = tdoa.get("threeDimensions", _threeDimensions).asBool();
 	_rmsError = tdoa.get("rmsError", _rmsError).asDouble();
 	_badThreshold = tdoa.get("badThreshold", _badThreshold).asDouble();
+	_solver = tdoa.get("solver", "simplex").asString() == "levenbergMarquardt" ? SOLVER_LEVENBERG_MARQUARDT : SOLVER_SIMPLEX;
+	_ellipseMode = tdoa.get("ellipseMode", "analytic").asString() == "contour" ? ELLIPSE_CONTOUR : ELLIPSE_ANALYTIC;
+	_refinement = fft::refinement(tdoa.get("peakRefinement", "upsample").asString());
+	_lagWindow = tdoa.get("lagWindow", _lagWindow).asBool();
+	_syncMargin_ns = tdoa.get("syncMargin_ns", _syncMargin_ns).asDouble();
+	ThreadPool::setSize(tdoa.get("threads", 0).asUInt());
+	_maxInFlight = tdoa.get("cohortsInFlight", 0).asUInt();
+	_starts = tdoa.get("starts", static_cast<Json::UInt>(_starts)).asUInt();
+	_alignTolerance_ns = tdoa.get("alignTolerance_ns", static_cast<Json::Int64>(_alignTolerance_ns)).asInt64();
+	_alignWait_ms = tdoa.get("alignWait_ms", _alignWait_ms).asInt();
 	std::string debugFile = tdoa.get("debugFile", "").asString();
 	if(!debugFile.empty())
 		_debug.open(debugFile, std::ios::out);
@@ -369,6 +701,30 @@ void tdoa::setParams(Json::Value config)
 		n->setParams(nodes[i]);
 		n->setParams(tdoa);
 	}
+	_aligner.configure(_nodes.size(), _alignTolerance_ns, _alignWait_ms);
+
+	//Precomputed grid for a fixed deployment, over the area given or round the middle of the nodes. Only
+	//rebuilt if the nodes or the area have changed.
+	std::vector<gridNode> fixed;
+	point3 middle = { 0, 0, 0 };
+	if (tdoa.get("gridOn", false).asBool())
+	{
+		for (auto n : _nodes)
+		{
+			gridNode g = { n->_host, n->_port, n->position().getCartesian() };
+			fixed.push_back(g);
+			middle.x += g._position.x;
+			middle.y += g._position.y;
+			middle.z += g._position.z;
+		}
+	}
+	location centre;
+	centre.setCartesian(middle);
+	if (tdoa.isMember("gridCentre"))
+		centre.setSpherical(tdoa["gridCentre"].get("lat", 0).asDouble(), tdoa["gridCentre"].get("lon", 0).asDouble(), 0);
+	_gridTolerance_m = tdoa.get("gridTolerance_m", _gridTolerance_m).asDouble();
+	_grid.configure(fixed, centre, tdoa.get("gridSize_m", 20000).asDouble(), tdoa.get("gridSpacing_m", 50).asDouble(),
+					tdoa.get("gridAltitude_m", 0).asDouble(), tdoa.get("gridFile", "").asString());
 }
 
 node *tdoa::addNode(Json::Value config)
@@ -397,33 +753,56 @@ void tdoa::run()
 		threads.push_back(std::thread(&node::run, n));
 	}
 
+	std::vector<alignedSet> ready;
 	while(!_terminate)
 	{
-		//Pop a pointer to IQ data from a node.
-		//We will be blocked waiting for data to appear.
-		capture *packet = _sharedQ.front();
-		//add the pointer to a multimap entry.
-		if (packet->iqData.size() > 0)
+		//Pop pointers to IQ data from the nodes, as many as are waiting up to a batch.
+		//We will be blocked waiting for data to appear, but no longer than the next aligner deadline.
+		capture *batch[16];
+		size_t count = _sharedQ.popBatch(batch, 16, _aligner.timeToDeadline(std::chrono::steady_clock::now()));
+		ready.clear();
+		for (size_t n = 0; n < count; n++)
 		{
-			//std::cout << "packet from " << packet->_host << ":" << packet->_port << " " << packet->_time 
-			//	      << "lat " << packet->_lati << " " << packet->_long << " " << packet->_alti << std::endl;
-			//Set key resolution to 1ms for synchronisation
-			int64_t key = packet->_time / 1000000;
-			//If first with this key then create a vector
-			if (_packets.find(key) == _packets.end())
+			capture *packet = batch[n];
+			if (packet->iqData.size() > 0)
 			{
-				std::vector<capture *> *cohort = new std::vector<capture *>;
-				_packets[key] = cohort;
+				//std::cout << "packet from " << packet->_host << ":" << packet->_port << " " << packet->_time 
+				//	      << "lat " << packet->_lati << " " << packet->_long << " " << packet->_alti << std::endl;
+				_aligner.add(packet, ready);
+			}
+			else
+			{
+				packet->release();
 			}
-			//Add the packet
-			_packets[key]->push_back(packet);
-			manageBuffer();
-		}
-		else
-		{
-			delete packet;
 		}
-		_sharedQ.pop();
+		_aligner.expire(std::chrono::steady_clock::now(), ready);
+		for (auto &set : ready)
+			process(set);
+		//Results held back for older sets still being aligned may now be free to go
+		std::lock_guard<std::mutex> lk(_inFlightMtx);
+		_oldestBuffered = _aligner.oldest();
+		release();
+	}
+
+	//Let cohorts already on the pool finish and pass on what they find
+	{
+		std::lock_guard<std::mutex> lk(cout_mtx);
+		std::cout << "aligner: " << _aligner._complete << " complete " << _aligner._partial << " partial sets, "
+				  << _aligner._late << " late " << _aligner._orphaned << " orphaned " << _aligner._duplicate << " duplicate captures" << std::endl;
+		if (_tracker.enabled())
+			std::cout << "tracker: " << _tracker._fixes << " fixes " << _tracker._outliers << " outliers " << _tracker._restarts << " restarts" << std::endl;
+	}
+	uint64_t dropped;
+	{
+		std::unique_lock<std::mutex> lk(_inFlightMtx);
+		_solved.wait(lk, [this] { return _running == 0; });
+		_oldestBuffered = std::numeric_limits<int64_t>::max();
+		release();
+		dropped = _dropped;
+	}
+	{
+		std::lock_guard<std::mutex> lk(cout_mtx);
+		std::cout << "results: " << dropped << " dropped with the display behind" << std::endl;
 	}
 
 	for (auto n : _nodes)
@@ -13,10 +13,34 @@
 #include <ratio>
 #include <random>
 #include <numeric>
-#include "safeQueue.h"
+#include <limits>
+#include <memory>
+#include "ringQueue.h"
 #include "fft.h"
 #include "node.h"
 #include "simplex.h"
+#include "levenbergMarquardt.h"
+#include "tdoaCost.h"
+#include "heatMap.h"
+#include "solverTrace.h"
+#include "tracker.h"
+#include "tdoaGrid.h"
+#include "aligner.h"
+#include "threadPool.h"
+
+//Position solvers selectable in the configuration
+enum positionSolver
+{
+	SOLVER_SIMPLEX,				//Nelder-Mead on the rms error, started at the master
+	SOLVER_LEVENBERG_MARQUARDT	//least squares on the per node residuals, falls back to the simplex if it fails
+};
+
+//How the uncertainty ellipse is found
+enum ellipseMode
+{
+	ELLIPSE_ANALYTIC,			//from the jacobian at the fix
+	ELLIPSE_CONTOUR				//search out from the fix for where the error reaches rmsError
+};
 
 class ellipse
 {
@@ -29,50 +53,144 @@ public:
 	double _angle;			//rotation angle of the ellipse
 };
 
+//A point visited by the search with the rms error there
+struct mapPoint
+{
+	point3 _position;			//earth centred
+	double _error;
+};
+
+//A fix and what goes with it for display. Only ever moved, the solver hands it on in a unique_ptr, so
+//nothing in it is copied on the way.
 class tdoaResult
 {
 public:
 	tdoaResult() {};
 	~tdoaResult() {};
-	std::deque<location> _nodes;
+	tdoaResult(const tdoaResult &) = delete;
+	tdoaResult &operator=(const tdoaResult &) = delete;
+	tdoaResult(tdoaResult &&) = default;
+	tdoaResult &operator=(tdoaResult &&) = default;
+	std::vector<point3> _nodes;		//earth centred, master first
 	struct
 	{
 		int64_t _timeStamp = { 0 };
 		location _centre;			//emitter location
 		ellipse _ellipse;
 	} _target;
-	std::deque<location> _heatmap;
+	heatRaster _heatmap;			//empty unless the heatmap is on
+	std::vector<mapPoint> _visited;	//last points the search tried, oldest first, if traceSamples is set
+};
+
+//What is known of a node in a cohort besides where it is and the delay measured there, which are kept apart
+//for the arithmetic. Same index as those.
+struct nodeInfo
+{
+	double _power;
+	int32_t _gain;				//as the capture has it, dB/16
+	uint32_t _port;
+	std::string _host;
+};
+
+//Everything belonging to one set of captures while it is being solved. Several cohorts may be on the
+//pool at once so the search state lives here rather than in tdoa. Owns the captures. Cohorts are reused,
+//so what is in here keeps its capacity from one set to the next.
+class cohort
+{
+public:
+	cohort() {};
+	~cohort() { clear(); };
+	//Give the captures back and empty everything for the next set
+	void clear()
+	{
+		for (auto pos : _captures)
+			pos->release();
+		_captures.clear();
+		_positions.clear();
+		_delays.clear();
+		_nodeInfo.clear();
+		_normal.resize(0);
+	};
+	int64_t _key = { 0 };
+	std::vector<capture *> _captures;
+	std::vector<point3> _positions;							//earth centred position of each node, master first
+	std::vector<int32_t> _delays;							//time difference to the master at each, ns
+	std::vector<nodeInfo> _nodeInfo;						//the rest, in the same order
+	enuFrame _frame;										//local frame the position is solved in
+	tdoaCost _cost;											//error function over the nodes
+	std::valarray<double> _normal;							//JtJ at the fix from the least squares solver, empty otherwise
+	solverTrace _trace;										//points the search tried, off unless traceSamples is set
+	point3 _target;											//fix, or the ellipse centre once found, in _frame
+	double _bearing;										//rotation angle of the ellipse
 };
 
 class tdoa
 {
 public:
 	tdoa();
-	tdoa(SafeQueue<tdoaResult *> *results) { _resultQ = results; };
+	tdoa(SpscQueue<std::unique_ptr<tdoaResult>> *results) { _resultQ = results; };
 	~tdoa();
 	std::vector<location> _searchLog;
-	location _target;
-	SafeQueue<tdoaResult *> *_resultQ;
-	SafeQueue<capture *> _sharedQ;
-	std::map<int64_t, std::vector<capture *> *> _packets;
+	SpscQueue<std::unique_ptr<tdoaResult>> *_resultQ;		//only pushed from release(), under _inFlightMtx
+	MpscQueue<capture *> _sharedQ;
+	aligner _aligner;										//groups the captures of each transmission
+	MpscQueue<cohort *> _spareCohorts;						//finished with, given back from the pool for process() to reuse
 	std::deque<node *> _nodes;
-	std::deque<location> _locations;						//we have a number of them
-	std::deque<location> _heatmap;
-	double _bearing;										//rotation angle of the ellipse
+	//Cohorts handed to the pool, oldest first. A result is only passed on once everything older has been
+	//solved and nothing older is still open in the aligner, so fixes arrive in timestamp order.
+	struct inFlight
+	{
+		bool done = { false };
+		std::unique_ptr<tdoaResult> result;
+	};
+	std::multimap<int64_t, inFlight> _inFlight;
+	std::mutex _inFlightMtx;								//guards _inFlight, _running, _oldestBuffered and _dropped
+	std::condition_variable _solved;
+	size_t _running = { 0 };								//cohorts on the pool not yet finished
+	uint64_t _dropped = { 0 };								//results lost because the display had fallen behind
+	int64_t _oldestBuffered = { std::numeric_limits<int64_t>::max() };
+	size_t _maxInFlight = { 0 };							//0 for one per pool thread
+	size_t _starts = { 4 };									//simplex searches run at once for each fix
+	int64_t _alignTolerance_ns = { 1000 };					//captures further apart than this are different transmissions
+	int32_t _alignWait_ms = { 1000 };						//how long a set waits for missing nodes
 	std::ofstream _debug;
 	bool _heatMapOn = { true };
+	size_t _traceSamples = { 0 };							//points of each solve kept for display, 0 for none
+	tracker _tracker;										//where the emitter is expected next, off unless configured
+	bool _trackSmooth = { true };							//pass on the tracker's estimate rather than the raw fix
+	tdoaGrid _grid;											//times of flight over the area for fixed nodes, off unless configured
+	double _gridTolerance_m = { 50 };						//how far a node may report itself from its configured position
+	heatMap _heatMap;
 	bool _threeDimensions = { false };
 	double _minAltitude = { 0 };
 	double _badThreshold = { 10 };
 	double _rmsError = { 100 };
+	positionSolver _solver = { SOLVER_SIMPLEX };
+	ellipseMode _ellipseMode = { ELLIPSE_ANALYTIC };
+	peakRefinement _refinement = { REFINE_NONE };			//sub-sample correlation peak refinement
+	bool _lagWindow = { true };								//only search lags possible given the node separation
+	double _syncMargin_ns = { 1000 };						//allowance for synchroniser error on top of that
 	void setParams(Json::Value config);
-	double error(std::valarray<double> &xyz);
+	double error(cohort &c, const double *xyz, size_t dimensions);
+	void errors(cohort &c, const pointBatch &points, double *rms);
+	void record(cohort &c, const double *xyz, size_t dimensions, double rms);
+	void errorsAround(cohort &c, const double *distance, const double *bearing, size_t count, double *rms);
 	//double negGradient(std::valarray<double> &xyz);
-	double gradient(std::valarray<double> &xyz);
-	double excessError(std::valarray<double> &distance);
+	double gradient(cohort &c, double alpha);
+	void gradients(cohort &c, const pointBatch &alpha, double *rms);
+	double excessError(cohort &c, double distance, double bearing);
+	void excessErrors(cohort &c, const pointBatch &distance, double bearing, double *excess);
+	double leastSquares(cohort &c, std::valarray<double> &xyz);
+	template <size_t N> double searchPosition(cohort &c, std::valarray<double> &xyz, double spread, uint32_t seed, const std::atomic<bool> *stop = NULL);
+	double multiStart(cohort &c, const std::valarray<double> &estimate, std::valarray<double> &xyz);
+	double warmStart(cohort &c, const point3 &expected, double sigma, size_t dimensions, std::valarray<double> &xyz);
+	void gridSeed(cohort &c, size_t dimensions, std::valarray<double> &seed);
+	void analyticEllipse(cohort &c, std::valarray<double> &xyz, double rms, ellipse &e);
 	int32_t correlate(capture *master, capture *slave);
-	void process(uint64_t key);
-	void manageBuffer();
+	std::unique_ptr<tdoaResult> solve(cohort &c);
+	void process(alignedSet &set);
+	void recycle(cohort *c);
+	void release();
 	void run();
 	void stop() { _terminate = true; }
 	std::atomic<bool> _terminate = { false };
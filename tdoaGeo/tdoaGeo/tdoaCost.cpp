@@ -0,0 +1,216 @@
+#include "tdoaCost.h"
+#include "levenbergMarquardt.h"
+#include <limits>
+#include <algorithm>
+
+//Time of flight per metre, ns
+static const double NS_PER_METRE = 1e9 / SPEED_OF_LIGHT;
+
+void tdoaCost::setNodes(const std::vector<point3> &positions, const std::vector<int32_t> &delays, const enuFrame &frame, bool threeDimensions, double minAltitude)
+{
+	_threeDimensions = threeDimensions;
+	_minAltitude = minAltitude;
+	_x.resize(positions.size());
+	_y.resize(positions.size());
+	_z.resize(positions.size());
+	_delta.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		point3 enu = frame.toLocal(positions[i]);
+		_x[i] = enu.x;
+		_y[i] = enu.y;
+		_z[i] = enu.z;
+		_delta[i] = delays[i];
+	}
+}
+
+double tdoaCost::evaluate(const std::valarray<double> &xyz) const
+{
+	return evaluate(&xyz[0], xyz.size());
+}
+
+double tdoaCost::evaluate(const double *xyz, size_t dimensions) const
+{
+	double rms;
+	evaluateBlock(&xyz[X], &xyz[Y], dimensions > 2 && _threeDimensions ? &xyz[Z] : NULL, 1, &rms);
+	return rms;
+}
+
+void tdoaCost::evaluate(const pointBatch &points, double *rms) const
+{
+	const double *z = points.coord.size() > 2 && _threeDimensions ? &points.coord[Z][0] : NULL;
+	for (size_t k = 0; k < points.count; k += BLOCK)
+	{
+		size_t count = std::min(BLOCK, points.count - k);
+		evaluateBlock(&points.coord[X][k], &points.coord[Y][k], z != NULL ? z + k : NULL, count, &rms[k]);
+	}
+}
+
+void tdoaCost::evaluateBlock(const double *x, const double *y, const double *z, size_t count, double *rms) const
+{
+	const size_t nodes = _x.size();
+	double pz[BLOCK], master[BLOCK], sum[BLOCK];
+	//Points on the surface of the earth if only east and north are being searched
+	bool surface = z == NULL;
+	if (surface)
+	{
+		for (size_t k = 0; k < count; k++)
+			pz[k] = enuFrame::surface(x[k], y[k]);
+		z = pz;
+	}
+	//Time of flight to the master. Its own term in the sum is just its measured delta, normally 0.
+	for (size_t k = 0; k < count; k++)
+	{
+		double dx = x[k] - _x[0], dy = y[k] - _y[0], dz = z[k] - _z[0];
+		master[k] = sqrt(dx * dx + dy * dy + dz * dz);
+		sum[k] = _delta[0] * _delta[0];
+	}
+	for (size_t i = 1; i < nodes; i++)
+	{
+		const double nx = _x[i], ny = _y[i], nz = _z[i], delta = _delta[i];
+		for (size_t k = 0; k < count; k++)
+		{
+			double dx = x[k] - nx, dy = y[k] - ny, dz = z[k] - nz;
+			double difference = (sqrt(dx * dx + dy * dy + dz * dz) - master[k]) * NS_PER_METRE - delta;
+			sum[k] += difference * difference;
+		}
+	}
+	//More than 100km from the master or below the minimum altitude is invalid
+	for (size_t k = 0; k < count; k++)
+	{
+		double altitude = surface ? 0 : altitudeOf(x[k], y[k], z[k]);
+		rms[k] = master[k] > 100000 || altitude < _minAltitude ? std::numeric_limits<double>::max() : sqrt(sum[k] / nodes);
+	}
+}
+
+bool tdoaCost::residuals(const std::valarray<double> &xyz, std::valarray<double> &r, std::valarray<double> &jacobian) const
+{
+	const size_t nodes = _x.size();
+	const size_t dims = xyz.size();
+	bool surface = dims < 3 || !_threeDimensions;
+	double x = xyz[X], y = xyz[Y];
+	//On the surface z follows from x and y, so its derivative is carried into theirs
+	double z, dzdx = 0, dzdy = 0;
+	if (surface)
+	{
+		z = enuFrame::surface(x, y);
+		double radius = EARTH_RADIUS + z;
+		if (radius > 0)
+		{
+			dzdx = -x / radius;
+			dzdy = -y / radius;
+		}
+	}
+	else
+		z = xyz[Z];
+	r.resize(nodes);
+	jacobian.resize(nodes * dims);
+	jacobian = 0;
+	//Unit vectors from each node towards the point. A point sat on a node has no direction, leave it zero.
+	std::valarray<double> u(3 * nodes);
+	double master = 0;
+	for (size_t i = 0; i < nodes; i++)
+	{
+		double dx = x - _x[i], dy = y - _y[i], dz = z - _z[i];
+		double range = sqrt(dx * dx + dy * dy + dz * dz);
+		if (i == 0)
+			master = range;
+		if (range > 0)
+		{
+			u[3 * i + X] = dx / range;
+			u[3 * i + Y] = dy / range;
+			u[3 * i + Z] = dz / range;
+		}
+		r[i] = i == 0 ? -_delta[0] : (range - master) * NS_PER_METRE - _delta[i];
+	}
+	for (size_t i = 1; i < nodes; i++)
+	{
+		double gx = (u[3 * i + X] - u[X]) * NS_PER_METRE;
+		double gy = (u[3 * i + Y] - u[Y]) * NS_PER_METRE;
+		double gz = (u[3 * i + Z] - u[Z]) * NS_PER_METRE;
+		if (surface)
+		{
+			jacobian[i * dims + X] = gx + gz * dzdx;
+			jacobian[i * dims + Y] = gy + gz * dzdy;
+		}
+		else
+		{
+			jacobian[i * dims + X] = gx;
+			jacobian[i * dims + Y] = gy;
+			jacobian[i * dims + Z] = gz;
+		}
+	}
+	double altitude = surface ? 0 : altitudeOf(x, y, z);
+	return master <= 100000 && altitude >= _minAltitude;
+}
+
+//Chan's method. With q the position and s_i node i both relative to the master, r0 the range to the master
+//and d_i the measured range difference, |q - s_i| = r0 + d_i squares to s_i.q + d_i.r0 = (|s_i|^2 - d_i^2)/2,
+//which is linear in q and r0. Solving for q in terms of r0 and putting that back into |q| = r0 leaves a
+//quadratic. On the surface q is taken in the east-north plane and the nodes' heights are ignored, which
+//over the distance between them is close enough for a starting point.
+bool tdoaCost::estimate(std::valarray<double> &xyz) const
+{
+	const size_t nodes = _x.size();
+	const size_t dims = xyz.size() < 3 || !_threeDimensions ? 2 : 3;
+	if (nodes < dims + 1)
+		return false;
+	//Least squares for q = a + b.r0, exact when there are only as many equations as dimensions
+	std::valarray<double> normal(0.0, dims * dims), ha(0.0, dims), hb(0.0, dims);
+	for (size_t i = 1; i < nodes; i++)
+	{
+		double s[3] = { _x[i] - _x[0], _y[i] - _y[0], _z[i] - _z[0] };
+		double s2 = 0;
+		for (size_t k = 0; k < dims; k++)
+			s2 += s[k] * s[k];
+		double d = _delta[i] / NS_PER_METRE;
+		double h = (s2 - d * d) / 2;
+		for (size_t j = 0; j < dims; j++)
+		{
+			for (size_t k = 0; k < dims; k++)
+				normal[j * dims + k] += s[j] * s[k];
+			ha[j] += s[j] * h;
+			hb[j] -= s[j] * d;
+		}
+	}
+	std::valarray<double> a(dims), b(dims), work = normal;
+	if (!levenbergMarquardt::solveLinear(work, ha, dims, a))
+		return false;
+	work = normal;
+	levenbergMarquardt::solveLinear(work, hb, dims, b);
+	//(|b|^2 - 1)r0^2 + 2a.b r0 + |a|^2 = 0. Noise can leave it just short of a root, take the nearest point.
+	double qa = (b * b).sum() - 1, qb = 2 * (a * b).sum(), qc = (a * a).sum();
+	double roots[2];
+	size_t count = 0;
+	if (std::abs(qa) < 1e-12)
+	{
+		if (qb != 0)
+			roots[count++] = -qc / qb;
+	}
+	else
+	{
+		double discriminant = std::max(qb * qb - 4 * qa * qc, 0.0);
+		roots[count++] = (-qb + sqrt(discriminant)) / (2 * qa);
+		roots[count++] = (-qb - sqrt(discriminant)) / (2 * qa);
+	}
+	//Keep whichever root in front of the master fits best
+	double best = std::numeric_limits<double>::max();
+	std::valarray<double> candidate(xyz.size());
+	for (size_t n = 0; n < count; n++)
+	{
+		if (roots[n] < 0)
+			continue;
+		double p[3] = { _x[0], _y[0], _z[0] };
+		for (size_t k = 0; k < dims; k++)
+			p[k] += a[k] + b[k] * roots[n];
+		for (size_t j = 0; j < candidate.size(); j++)
+			candidate[j] = p[j];
+		double rms = evaluate(candidate);
+		if (rms < best)
+		{
+			best = rms;
+			xyz = candidate;
+		}
+	}
+	return best < std::numeric_limits<double>::max();
+}
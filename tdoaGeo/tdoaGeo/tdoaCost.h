@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <valarray>
+#include "location.h"
+#include "simplex.h"
+
+//The rms error in ns between the time differences a candidate emitter position would give and those
+//measured, which the solver minimises. The node positions and measured deltas are taken once per cohort
+//and held as arrays, so a batch of candidates is evaluated without building a location for each and
+//the inner loops over the candidates vectorise. Positions are east, north and up in the cohort's frame.
+class tdoaCost
+{
+public:
+	tdoaCost() {};
+	~tdoaCost() {};
+	//Earth centred node positions and the delay measured at each relative to the first, the master, in ns
+	void setNodes(const std::vector<point3> &positions, const std::vector<int32_t> &delays, const enuFrame &frame, bool threeDimensions, double minAltitude);
+	//With two coordinates, or when not solving in three dimensions, the point is taken to be on the surface
+	//of the earth as enuFrame::toLocation() does.
+	void evaluate(const pointBatch &points, double *rms) const;
+	double evaluate(const std::valarray<double> &xyz) const;
+	double evaluate(const double *xyz, size_t dimensions) const;
+	//The terms of the same error, one per node, and their derivatives for the least squares solver. jacobian
+	//is nodes x dimensions, row major, in ns per metre. Returns false where evaluate() would give max.
+	bool residuals(const std::valarray<double> &xyz, std::valarray<double> &r, std::valarray<double> &jacobian) const;
+	//Closed form estimate of the position to start the solvers from, in as many dimensions as xyz has.
+	//Returns false if the geometry gives no answer.
+	bool estimate(std::valarray<double> &xyz) const;
+private:
+	static const size_t BLOCK = 64;				//candidates per pass, kept on the stack
+	void evaluateBlock(const double *x, const double *y, const double *z, size_t count, double *rms) const;
+	//Height above the surface of the earth of a point in the frame
+	static double altitudeOf(double x, double y, double z)
+	{
+		double radius = EARTH_RADIUS + z;
+		return (x * x + y * y + z * (EARTH_RADIUS + radius)) / (sqrt(radius * radius + x * x + y * y) + EARTH_RADIUS);
+	};
+	std::vector<double> _x, _y, _z;				//node positions, master first
+	std::vector<double> _delta;					//measured time differences to the master, ns
+	bool _threeDimensions = { false };
+	double _minAltitude = { 0 };
+};
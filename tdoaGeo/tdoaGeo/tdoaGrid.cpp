@@ -0,0 +1,193 @@
+#include "tdoaGrid.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+extern std::mutex cout_mtx;
+
+//Start of a saved table, changed whenever the layout of the file does
+static const char MAGIC[8] = { 'T', 'D', 'O', 'A', 'G', 'R', '0', '1' };
+
+tdoaGrid::~tdoaGrid()
+{
+	stopBuilding();
+}
+
+void tdoaGrid::stopBuilding()
+{
+	if (_builder.joinable())
+	{
+		_cancel = true;
+		_builder.join();
+	}
+	_cancel = false;
+}
+
+void tdoaGrid::configure(const std::vector<gridNode> &nodes, const location &centre, double size, double spacing, double altitude, const std::string &file)
+{
+	std::lock_guard<std::mutex> lk(_mtx);
+	table layout;
+	layout._nodes = nodes;
+	layout._lat = centre.getLat();
+	layout._lon = centre.getLon();
+	layout._size = size;
+	layout._spacing = spacing > 0 ? spacing : 1;
+	layout._altitude = altitude;
+	layout._cells = std::max<size_t>(1, static_cast<size_t>(std::lround(size / layout._spacing)));
+	layout._frame.setOrigin(location(layout._lat, layout._lon, 0));
+	if (layout.sameLayout(_layout))
+		return;
+	//The old table is wrong for the new layout, don't let it be used while the new one is made
+	stopBuilding();
+	std::atomic_store(&_table, std::shared_ptr<const table>());
+	_layout = layout;
+	if (nodes.empty())
+		return;
+	_builder = std::thread([this, layout, file]()
+	{
+		std::shared_ptr<table> t = std::make_shared<table>(layout);
+		auto start = std::chrono::steady_clock::now();
+		bool loaded = !file.empty() && load(*t, file);
+		if (!loaded && !build(*t, _cancel))
+			return;
+		if (!loaded && !file.empty())
+			save(*t, file);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::atomic_store(&_table, std::shared_ptr<const table>(t));
+		std::lock_guard<std::mutex> lk(cout_mtx);
+		std::cout << "grid of " << t->_cells << "x" << t->_cells << " cells " << (loaded ? "loaded" : "built") << " in " << ms << "ms" << std::endl;
+	});
+}
+
+bool tdoaGrid::build(table &t, const std::atomic<bool> &cancel)
+{
+	const size_t cells = t._cells * t._cells;
+	t._flight.resize(t._nodes.size() * cells);
+	for (size_t row = 0; row < t._cells; row++)
+	{
+		if (cancel)
+			return false;
+		for (size_t column = 0; column < t._cells; column++)
+		{
+			point3 p = t.cell(column, row);
+			for (size_t n = 0; n < t._nodes.size(); n++)
+			{
+				const point3 &node = t._nodes[n]._position;
+				double dx = p.x - node.x, dy = p.y - node.y, dz = p.z - node.z;
+				t._flight[n * cells + row * t._cells + column] = static_cast<float>(1e9 * sqrt(dx * dx + dy * dy + dz * dz) / SPEED_OF_LIGHT);
+			}
+		}
+	}
+	return true;
+}
+
+//Everything the layout depends on is written ahead of the times, so a file made for anything else is ignored
+static void writeLayout(std::ostream &os, const tdoaGrid::table &t)
+{
+	os.write(MAGIC, sizeof(MAGIC));
+	uint32_t count = static_cast<uint32_t>(t._nodes.size());
+	os.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	for (auto &n : t._nodes)
+	{
+		uint32_t length = static_cast<uint32_t>(n._host.size());
+		os.write(reinterpret_cast<const char *>(&length), sizeof(length));
+		os.write(n._host.data(), length);
+		os.write(reinterpret_cast<const char *>(&n._port), sizeof(n._port));
+		os.write(reinterpret_cast<const char *>(&n._position), sizeof(n._position));
+	}
+	const double area[5] = { t._lat, t._lon, t._size, t._spacing, t._altitude };
+	os.write(reinterpret_cast<const char *>(area), sizeof(area));
+	uint64_t cells = t._cells;
+	os.write(reinterpret_cast<const char *>(&cells), sizeof(cells));
+}
+
+bool tdoaGrid::save(const table &t, const std::string &file)
+{
+	std::ofstream os(file, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!os.is_open())
+		return false;
+	writeLayout(os, t);
+	os.write(reinterpret_cast<const char *>(t._flight.data()), t._flight.size() * sizeof(float));
+	return os.good();
+}
+
+bool tdoaGrid::load(table &t, const std::string &file)
+{
+	std::ifstream is(file, std::ios::in | std::ios::binary);
+	if (!is.is_open())
+		return false;
+	//Compare the header byte for byte with the one this layout would have
+	std::ostringstream expected;
+	writeLayout(expected, t);
+	std::string header = expected.str();
+	std::string found(header.size(), '\0');
+	if (!is.read(&found[0], found.size()) || found != header)
+		return false;
+	t._flight.resize(t._nodes.size() * t._cells * t._cells);
+	is.read(reinterpret_cast<char *>(t._flight.data()), t._flight.size() * sizeof(float));
+	return static_cast<size_t>(is.gcount()) == t._flight.size() * sizeof(float);
+}
+
+int tdoaGrid::table::index(const std::string &host, uint32_t port, const point3 &position, double tolerance) const
+{
+	for (size_t n = 0; n < _nodes.size(); n++)
+	{
+		const gridNode &node = _nodes[n];
+		if (node._host != host || node._port != port)
+			continue;
+		double dx = position.x - node._position.x, dy = position.y - node._position.y, dz = position.z - node._position.z;
+		return dx * dx + dy * dy + dz * dz <= tolerance * tolerance ? static_cast<int>(n) : -1;
+	}
+	return -1;
+}
+
+bool tdoaGrid::table::match(const int *nodes, const int32_t *delays, size_t count, point3 &position, double &rms) const
+{
+	const size_t cells = _cells * _cells;
+	if (count < 3 || _flight.size() < _nodes.size() * cells)
+		return false;
+	//Squared error of every cell, one node at a time so each pass is a straight run over two arrays
+	thread_local std::vector<float> sum;
+	sum.assign(cells, 0);
+	const float *master = &_flight[nodes[0] * cells];
+	for (size_t i = 1; i < count; i++)
+	{
+		const float *flight = &_flight[nodes[i] * cells];
+		const float delay = static_cast<float>(delays[i] - delays[0]);
+		for (size_t k = 0; k < cells; k++)
+		{
+			float difference = flight[k] - master[k] - delay;
+			sum[k] += difference * difference;
+		}
+	}
+	size_t best = std::min_element(sum.begin(), sum.end()) - sum.begin();
+	position = cell(best % _cells, best / _cells);
+	rms = sqrt(sum[best] / count);
+	return true;
+}
+
+point3 tdoaGrid::table::cell(size_t column, size_t row) const
+{
+	point3 enu;
+	enu.x = (column - (_cells - 1) / 2.0) * _spacing;
+	enu.y = (row - (_cells - 1) / 2.0) * _spacing;
+	enu.z = enuFrame::surface(enu.x, enu.y) + _altitude;
+	return _frame.toEarth(enu, false);
+}
+
+bool tdoaGrid::table::sameLayout(const table &t) const
+{
+	if (_nodes.size() != t._nodes.size() || _lat != t._lat || _lon != t._lon || _size != t._size ||
+		_spacing != t._spacing || _altitude != t._altitude || _cells != t._cells)
+		return false;
+	for (size_t n = 0; n < _nodes.size(); n++)
+	{
+		const gridNode &a = _nodes[n], &b = t._nodes[n];
+		if (a._host != b._host || a._port != b._port || a._position.x != b._position.x ||
+			a._position.y != b._position.y || a._position.z != b._position.z)
+			return false;
+	}
+	return true;
+}
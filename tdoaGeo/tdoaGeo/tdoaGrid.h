@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include "location.h"
+
+//A node of a fixed deployment as the grid knows it
+struct gridNode
+{
+	std::string _host;
+	uint32_t _port;
+	point3 _position;						//earth centred
+};
+
+//Time of flight from every cell of a fixed area to every node of a fixed deployment, worked out in advance,
+//so a set of measured delays is matched to the best cell over the whole area by a scan of flat arrays
+//rather than a search. The time difference between any pair of nodes is the difference of their times of
+//flight, so one array per node serves every pair and whichever node is the master. The table is built on
+//a thread of its own when the nodes or area change and swapped in once finished; until then there is none.
+//It can be kept in a file so it needn't be built again at the next start.
+class tdoaGrid
+{
+public:
+	struct table
+	{
+		std::vector<gridNode> _nodes;
+		double _lat = { 0 };				//centre of the area
+		double _lon = { 0 };
+		double _size = { 0 };				//side of the square, m
+		double _spacing = { 0 };			//between cells, m
+		double _altitude = { 0 };			//of every cell, m
+		size_t _cells = { 0 };				//along each side
+		enuFrame _frame;					//origin at the centre of the area
+		std::vector<float> _flight;			//ns, node major then row major from the south west
+		//Index of the node at host:port, or -1 if the table doesn't have it or it is more than tolerance m
+		//from where the table has it
+		int index(const std::string &host, uint32_t port, const point3 &position, double tolerance) const;
+		//Best cell for delays in ns at nodes (table indices), each relative to the first. Gives its earth
+		//centred position and the rms error there.
+		bool match(const int *nodes, const int32_t *delays, size_t count, point3 &position, double &rms) const;
+		point3 cell(size_t column, size_t row) const;
+		bool sameLayout(const table &t) const;
+	};
+
+	tdoaGrid() {};
+	~tdoaGrid();
+	//Loads or rebuilds the table in the background if anything differs from what it has. No nodes turns
+	//it off.
+	void configure(const std::vector<gridNode> &nodes, const location &centre, double size, double spacing, double altitude, const std::string &file);
+	//The table to use, or none if it is off or not yet built. Safe from any thread, and the table stays
+	//good for as long as it is held even if a rebuild replaces it.
+	std::shared_ptr<const table> snapshot() const { return std::atomic_load(&_table); };
+private:
+	static bool build(table &t, const std::atomic<bool> &cancel);
+	static bool load(table &t, const std::string &file);
+	static bool save(const table &t, const std::string &file);
+	void stopBuilding();
+	std::shared_ptr<const table> _table;
+	table _layout;							//what was last asked for, without the times
+	std::mutex _mtx;						//configure() only
+	std::thread _builder;
+	std::atomic<bool> _cancel = { false };
+};
@@ -0,0 +1,190 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+//A fixed set of worker threads shared by the whole process, so no threads are created per measurement.
+//Each worker has its own deque of tasks. It takes its own newest first and, once that is empty, steals the
+//oldest from the others. Tasks submitted from a worker go on that worker's deque so nested work stays
+//local; other threads spread theirs round robin. A thread waiting for a result runs queued tasks in the
+//meantime rather than blocking, so a task may wait on tasks it has submitted without starving the pool.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t threads = 0)
+	{
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		_queues.resize(threads);
+		for (auto &q : _queues)
+			q.reset(new queue);
+		for (size_t i = 0; i < threads; i++)
+			_workers.push_back(std::thread(&ThreadPool::worker, this, i));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+			_stop = true;
+		}
+		_wake.notify_all();
+		for (auto &t : _workers)
+			t.join();
+	}
+
+	//The process wide pool, built on first use with the size last given to setSize (0 for one thread
+	//per core)
+	static ThreadPool &shared()
+	{
+		static ThreadPool pool(configuredSize());
+		return pool;
+	}
+
+	static void setSize(size_t threads)
+	{
+		configuredSize() = threads;
+	}
+
+	size_t size() const
+	{
+		return _workers.size();
+	}
+
+	//Queue f() and return a future for its result. Exceptions thrown by f are passed on through the future.
+	template <class F> auto submit(F f) -> std::future<decltype(f())>
+	{
+		typedef decltype(f()) R;
+		auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+		std::future<R> result = task->get_future();
+		push([task]() { (*task)(); });
+		return result;
+	}
+
+	//Get the result of a submitted task, running other queued tasks until it is ready
+	template <class T> T wait(std::future<T> &f)
+	{
+		while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			if (!runOne())
+				f.wait_for(std::chrono::milliseconds(1));
+		}
+		return f.get();
+	}
+
+private:
+	struct queue
+	{
+		std::mutex mtx;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	static size_t &configuredSize()
+	{
+		static size_t threads = 0;
+		return threads;
+	}
+
+	//Which pool and worker the calling thread belongs to, if any
+	static ThreadPool *&currentPool()
+	{
+		thread_local ThreadPool *pool = NULL;
+		return pool;
+	}
+	static size_t &currentIndex()
+	{
+		thread_local size_t index = 0;
+		return index;
+	}
+
+	void push(std::function<void()> task)
+	{
+		size_t i = currentPool() == this ? currentIndex() : _next++ % _queues.size();
+		//Count it first so the count can never drop below zero when a worker takes it straight away
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+			_pending++;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_queues[i]->mtx);
+			_queues[i]->tasks.push_back(std::move(task));
+		}
+		_wake.notify_one();
+	}
+
+	//Own deque newest first, then the oldest task of each of the others in turn
+	bool pop(size_t home, std::function<void()> &task)
+	{
+		{
+			queue &q = *_queues[home];
+			std::lock_guard<std::mutex> lock(q.mtx);
+			if (!q.tasks.empty())
+			{
+				task = std::move(q.tasks.back());
+				q.tasks.pop_back();
+				return true;
+			}
+		}
+		for (size_t k = 1; k < _queues.size(); k++)
+		{
+			queue &q = *_queues[(home + k) % _queues.size()];
+			std::lock_guard<std::mutex> lock(q.mtx);
+			if (!q.tasks.empty())
+			{
+				task = std::move(q.tasks.front());
+				q.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool runOne()
+	{
+		std::function<void()> task;
+		size_t home = currentPool() == this ? currentIndex() : _next % _queues.size();
+		if (!pop(home, task))
+			return false;
+		{
+			std::lock_guard<std::mutex> lock(_mtx);
+			_pending--;
+		}
+		task();
+		return true;
+	}
+
+	void worker(size_t index)
+	{
+		currentPool() = this;
+		currentIndex() = index;
+		while (true)
+		{
+			if (runOne())
+				continue;
+			std::unique_lock<std::mutex> lock(_mtx);
+			_wake.wait(lock, [this] { return _stop || _pending > 0; });
+			if (_stop && _pending == 0)
+				return;
+		}
+	}
+
+	std::vector<std::unique_ptr<queue>> _queues;
+	std::vector<std::thread> _workers;
+	std::atomic<size_t> _next = { 0 };
+	std::mutex _mtx;
+	std::condition_variable _wake;
+	size_t _pending = { 0 };				//tasks queued but not yet taken, guarded by _mtx
+	bool _stop = { false };
+};
+#endif
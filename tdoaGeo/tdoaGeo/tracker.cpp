@@ -0,0 +1,134 @@
+#include "tracker.h"
+#include <cmath>
+#include <algorithm>
+
+//Spread of the velocity when a track starts, m/s. Anything up to a fast vehicle.
+static const double START_SPEED = 50;
+
+void tracker::configure(trackModel model, double fixError, double noise, double gate, int misses, double timeout_s)
+{
+	std::lock_guard<std::mutex> lk(_mtx);
+	_model = model;
+	_fixError = std::max(fixError, 1e-3);
+	_noise = std::max(noise, 0.0);
+	_gate = gate;
+	_maxMisses = std::max(misses, 1);
+	_timeout = timeout_s;
+	_tracking = false;
+}
+
+//Predict the axis dt seconds on
+void tracker::advance(axis &a, double dt) const
+{
+	if (_model == TRACK_VELOCITY)
+	{
+		//Constant velocity with a random acceleration of _noise through each step
+		double q = _noise * _noise;
+		a.p += a.v * dt;
+		a.pp += dt * (2 * a.pv + dt * a.vv) + q * dt * dt * dt * dt / 4;
+		a.pv += dt * a.vv + q * dt * dt * dt / 2;
+		a.vv += q * dt * dt;
+	}
+	else
+		a.pp += _noise * _noise * dt * dt;
+}
+
+void tracker::restart(int64_t time, const point3 &position)
+{
+	const double start[3] = { position.x, position.y, position.z };
+	for (size_t i = 0; i < 3; i++)
+	{
+		axis &a = _axes[i];
+		a.p = start[i];
+		a.v = 0;
+		a.pp = _fixError * _fixError;
+		a.pv = 0;
+		a.vv = _model == TRACK_VELOCITY ? START_SPEED * START_SPEED : 0;
+	}
+	_time = time;
+	_misses = 0;
+	_tracking = true;
+}
+
+bool tracker::predict(int64_t time, point3 &position, double &sigma) const
+{
+	std::lock_guard<std::mutex> lk(_mtx);
+	double dt = std::max<double>(time - _time, 0) / 1e9;
+	if (_model == TRACK_OFF || !_tracking || dt > _timeout)
+		return false;
+	double p[3], variance = 0;
+	for (size_t i = 0; i < 3; i++)
+	{
+		axis a = _axes[i];
+		advance(a, dt);
+		p[i] = a.p;
+		variance = std::max(variance, a.pp);
+	}
+	position.x = p[X];
+	position.y = p[Y];
+	position.z = p[Z];
+	sigma = sqrt(variance);
+	return true;
+}
+
+bool tracker::update(int64_t time, point3 &position)
+{
+	std::lock_guard<std::mutex> lk(_mtx);
+	if (_model == TRACK_OFF)
+		return false;
+	double dt = std::max<double>(time - _time, 0) / 1e9;
+	if (!_tracking || dt > _timeout)
+	{
+		_restarts += _tracking ? 1 : 0;
+		restart(time, position);
+		_fixes++;
+		return true;
+	}
+	axis predicted[3];
+	const double z[3] = { position.x, position.y, position.z };
+	const double r = _fixError * _fixError;
+	//Squared distance from the prediction in standard deviations
+	double distance = 0;
+	for (size_t i = 0; i < 3; i++)
+	{
+		predicted[i] = _axes[i];
+		advance(predicted[i], dt);
+		double innovation = z[i] - predicted[i].p;
+		distance += innovation * innovation / (predicted[i].pp + r);
+	}
+	if (distance > _gate * _gate)
+	{
+		_outliers++;
+		//The emitter has moved on, or it is a different one
+		if (++_misses >= _maxMisses)
+		{
+			_restarts++;
+			restart(time, position);
+			_fixes++;
+			return true;
+		}
+		return false;
+	}
+	double filtered[3];
+	for (size_t i = 0; i < 3; i++)
+	{
+		axis &a = predicted[i];
+		double s = a.pp + r;
+		double kp = a.pp / s, kv = a.pv / s;
+		double innovation = z[i] - a.p;
+		a.p += kp * innovation;
+		a.v += kv * innovation;
+		a.vv -= kv * a.pv;
+		a.pv -= kp * a.pv;
+		a.pp -= kp * a.pp;
+		_axes[i] = a;
+		filtered[i] = a.p;
+	}
+	position.x = filtered[X];
+	position.y = filtered[Y];
+	position.z = filtered[Z];
+	_time = time;
+	_misses = 0;
+	_fixes++;
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <mutex>
+#include <cstdint>
+#include "location.h"
+
+//Motion assumed by the tracker
+enum trackModel
+{
+	TRACK_OFF,
+	TRACK_POSITION,				//stationary but for a random wander
+	TRACK_VELOCITY				//moving steadily but for random changes of speed and course
+};
+
+//Kalman filter on the fixes of one emitter, so a solve can start where the emitter is expected to be rather
+//than from nothing. Earth centred, as successive cohorts may be solved in different frames, with each axis
+//filtered on its own. A fix too far from the prediction is left out; after several in a row, or a long
+//gap, the track starts again from the latest fix. Fixes must be given in time order, predictions may be
+//asked for from any thread.
+class tracker
+{
+public:
+	tracker() {};
+	~tracker() {};
+	//fixError is the standard deviation of a fix in m. noise is how far the motion may stray from the
+	//model: m/s for TRACK_POSITION, m/s per second for TRACK_VELOCITY. A fix more than gate standard
+	//deviations from the prediction is an outlier.
+	void configure(trackModel model, double fixError, double noise, double gate, int misses, double timeout_s);
+	bool enabled() const { return _model != TRACK_OFF; };
+	//Where the emitter should be at time (ns) and the standard deviation of that in m. Returns false if
+	//there is no track to go on.
+	bool predict(int64_t time, point3 &position, double &sigma) const;
+	//Fold in a fix at time. Returns true if it was used, and position is then the filtered estimate.
+	bool update(int64_t time, point3 &position);
+	uint64_t _fixes = { 0 };				//used
+	uint64_t _outliers = { 0 };				//left out
+	uint64_t _restarts = { 0 };				//times the track was started again
+private:
+	//Position and velocity along one axis and their covariance
+	struct axis
+	{
+		double p, v;
+		double pp, pv, vv;
+	};
+	void advance(axis &a, double dt) const;
+	void restart(int64_t time, const point3 &position);
+	mutable std::mutex _mtx;
+	trackModel _model = { TRACK_OFF };
+	double _fixError = { 30 };
+	double _noise = { 1 };
+	double _gate = { 5 };
+	int _maxMisses = { 3 };
+	double _timeout = { 10 };				//s
+	bool _tracking = { false };
+	int64_t _time = { 0 };					//of the last fix used, ns
+	int _misses = { 0 };
+	axis _axes[3];
+};